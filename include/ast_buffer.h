@@ -6,21 +6,53 @@
 #define GEDITOR_AST_BUFFER_H
 #include <piece_table.h>
 #include <tree_sitter.h>
+#include <session.h>
+#include <decl_splitter.h>
+#include <live_query.h>
+#include <atomic>
+#include <thread>
+#include <cstring>
 template <class char_t = char, class string_t = std::basic_string<char_t>>
 class ASTBuffer {
     using buffer_t = PieceTable<char_t, string_t>;
     using buffer_iter_t = typename buffer_t ::iter_t;
+    using session_t = Session<char_t, string_t>;
     buffer_t m_buffer;
     ts::Parser m_parser;
     ts::Tree m_tree;
+    session_t *m_session = nullptr;
+    using live_query_t = LiveQuery<char_t, string_t>;
+    std::vector<live_query_t *> m_live_queries;
+    // Tree edits since the last parse, kept only while a live query listens
+    std::vector<TSInputEdit> m_edits;
+    // Shortest piece worth a parser of its own in parse_parallel
+    constexpr static uint32_t parallel_piece_length = 1 << 16;
 public:
     ASTBuffer() = default;
     ASTBuffer(ts::Language language) : m_parser(language) {}
     inline buffer_t &buffer() { return m_buffer; }
     inline ts::Tree &tree() { return m_tree; }
     inline ts::Parser &parser() { return m_parser; }
+    // What the last parse() lexed, reused and built, see ts_parser_stats
+    inline TSParseStats parse_stats() { return m_parser.stats(); }
+    // Journal every text edit to the session, origin edits need a session save()
+    inline void set_session(session_t *session) { m_session = session; }
+    // Called by LiveQuery, it hears of every parse until detached
+    inline void attach(live_query_t *query) { m_live_queries.push_back(query); }
+    inline void detach(live_query_t *query) {
+        m_live_queries.erase(std::remove(m_live_queries.begin(), m_live_queries.end(), query),
+                             m_live_queries.end());
+    }
     inline uint32_t length() { return m_buffer.size(); }
+    // The code unit size picks the encoding, a 4 byte wchar_t is UTF32 like char32_t
+    static constexpr TSInputEncoding encoding() {
+        return sizeof(char_t) == 1 ? TSInputEncodingUTF8 :
+               sizeof(char_t) == 2 ? TSInputEncodingUTF16 : TSInputEncodingUTF32;
+    }
     inline TSPoint get_point(uint32_t pos) {
+        if (pos == 0) {
+            return {0, 0};
+        }
         size_t line = m_buffer.get_line(pos);
         return {line, (pos - m_buffer.line_start(line)) * sizeof(char_t)};
     }
@@ -33,83 +65,234 @@ public:
         input.new_end_point = get_point(input.new_end_byte / sizeof(char_t));
     };
     inline const char_t &operator[] (const size_t &index) { return m_buffer.char_at(index); }
-    buffer_iter_t insert_origin(uint32_t pos, const char_t *map, size_t length) {
+    buffer_iter_t insert_origin(uint32_t pos, const char_t *map, size_t length,
+                                const uint32_t *lines = nullptr, size_t line_count = 0) {
+        TRACE_SCOPE("ASTBuffer::insert_origin");
         if (!m_tree.empty()) {
             TSInputEdit input;
             input.start_byte = pos * sizeof(char_t);
             input.old_end_byte = input.start_byte;
             input.new_end_byte = input.start_byte + length * sizeof(char_t);
             fixup_input(input);
-            m_tree.edit(input);
+            edit_tree(input);
         }
-        auto iter = m_buffer.insert_origin(pos, map, length);
+        auto iter = lines ? m_buffer.insert_origin(pos, map, length, lines, line_count) :
+                    m_buffer.insert_origin(pos, map, length);
         parse();
         return iter;
     }
-    buffer_iter_t append_origin(const char_t *map, size_t length) {
+    buffer_iter_t append_origin(const char_t *map, size_t length,
+                                const uint32_t *lines = nullptr, size_t line_count = 0) {
+        TRACE_SCOPE("ASTBuffer::append_origin");
         if (!m_tree.empty()) {
             TSInputEdit input;
             input.start_byte = m_buffer.size() * sizeof(char_t);
             input.old_end_byte = input.start_byte;
             input.new_end_byte = input.start_byte + length * sizeof(char_t);
             fixup_input(input);
-            m_tree.edit(input);
+            edit_tree(input);
         }
-        auto iter = m_buffer.append_origin(map, length);
+        auto iter = lines ? m_buffer.append_origin(map, length, lines, line_count) :
+                    m_buffer.append_origin(map, length);
         parse();
         return iter;
     }
     buffer_iter_t append(const string_t &str) {
+        TRACE_SCOPE("ASTBuffer::append");
         if (!m_tree.empty()) {
             TSInputEdit input;
             input.start_byte = m_buffer.size() * sizeof(char_t);
             input.old_end_byte = input.start_byte;
             input.new_end_byte = input.start_byte + str.length() * sizeof(char_t);
             fixup_input(input);
-            m_tree.edit(input);
+            edit_tree(input);
+        }
+        if (m_session) {
+            m_session->record_insert(m_buffer.size(), str);
         }
         auto iter = m_buffer.append(str);
         parse();
         return iter;
     }
     buffer_iter_t insert(uint32_t pos, const string_t &str) {
+        TRACE_SCOPE("ASTBuffer::insert");
         if (!m_tree.empty()) {
             TSInputEdit input;
             input.start_byte = pos * sizeof(char_t);
             input.old_end_byte = input.start_byte;
             input.new_end_byte = input.start_byte + str.length() * sizeof(char_t);
             fixup_input(input);
-            m_tree.edit(input);
+            edit_tree(input);
+        }
+        if (m_session) {
+            m_session->record_insert(pos, str);
         }
         auto iter = m_buffer.insert(pos, str);
         parse();
         return iter;
     }
     void erase(uint32_t start, uint32_t end) {
+        TRACE_SCOPE("ASTBuffer::erase");
         if (!m_tree.empty()) {
             TSInputEdit input;
-            input.start_byte = start;
-            input.old_end_byte = end;
-            input.new_end_byte = start;
+            input.start_byte = start * sizeof(char_t);
+            input.old_end_byte = end * sizeof(char_t);
+            input.new_end_byte = input.start_byte;
             fixup_input(input);
-            m_tree.edit(input);
+            edit_tree(input);
+        }
+        if (m_session) {
+            m_session->record_erase(start, end);
         }
         m_buffer.erase(start, end);
         parse();
     }
+    // Replace the whole document with content through a minimal set of edits,
+    // so the unchanged subtrees survive the reparse
+    void replace_all(const string_t &content) {
+        TRACE_SCOPE("ASTBuffer::replace_all");
+        size_t size = m_buffer.size();
+        size_t prefix = m_buffer.common_prefix(content.data(), content.length());
+        size_t suffix = m_buffer.common_suffix(content.data(), content.length(),
+                                               std::min(size, content.length()) - prefix);
+        if (prefix == size && prefix == content.length()) {
+            return;
+        }
+        string_t middle = m_buffer.range_string(prefix, size - suffix);
+        const char_t *new_middle = content.data() + prefix;
+        auto hunks = LineDiff<char_t>::diff(middle.data(), middle.length(),
+                                            new_middle, content.length() - prefix - suffix);
+        // back to front, so the offsets of the earlier hunks stay valid
+        std::vector<TSInputEdit> edits;
+        for (auto hunk = hunks.rbegin(); hunk != hunks.rend(); ++hunk) {
+            replace(prefix + hunk->start, prefix + hunk->end,
+                    string_t(new_middle + hunk->new_start, hunk->new_end - hunk->new_start), edits);
+        }
+        if (!m_tree.empty()) {
+            if (!m_live_queries.empty()) {
+                m_edits.insert(m_edits.end(), edits.begin(), edits.end());
+            }
+            std::reverse(edits.begin(), edits.end());
+            m_tree.edit(edits);
+        }
+        parse();
+    }
     string_t node_string(const ts::Node& node) {
         return m_buffer.range_string(node.start_byte() / sizeof(char_t),
                                      (node.start_byte() + node.length()) / sizeof(char_t));
     };
+    // Text of node byte ranges for the query predicates, compared in place in the
+    // piece table: cursor.next_capture(index, ast)
+    bool equal(uint32_t start_byte, uint32_t end_byte, const char *str, size_t length) {
+        static_assert(sizeof(char_t) == 1, "query strings are UTF-8");
+        return m_buffer.range_equal(start_byte, end_byte, (const char_t *) str, length);
+    }
+    bool equal(uint32_t start_byte, uint32_t end_byte, uint32_t other_start, uint32_t other_end) {
+        return m_buffer.range_equal(start_byte / sizeof(char_t), end_byte / sizeof(char_t),
+                                    other_start / sizeof(char_t), other_end / sizeof(char_t));
+    }
+    bool search(uint32_t start_byte, uint32_t end_byte, const std::regex &regex) {
+        static_assert(sizeof(char_t) == 1, "query regexes are UTF-8");
+        if (auto *str = m_buffer.contiguous(start_byte, end_byte)) {
+            return std::regex_search(str, str + (end_byte - start_byte), regex);
+        }
+        return std::regex_search(m_buffer.chars(start_byte, start_byte, end_byte),
+                                 m_buffer.chars(end_byte, start_byte, end_byte), regex);
+    }
     void parse() {
-        size_t byte_size = m_buffer.size() * sizeof(char_t);
-        m_parser.parse(m_tree, [&](uint32_t byte, TSPoint pt, uint32_t &read_byte) -> const void * {
-            if (byte >= byte_size) {
-                return nullptr;
+        TRACE_SCOPE("ASTBuffer::parse");
+        if (m_live_queries.empty()) {
+            parse_piece(m_parser, m_tree, 0, m_buffer.size());
+            return;
+        }
+        ts::Tree old_tree;
+        if (!m_tree.empty()) {
+            old_tree = m_tree.copy();
+        }
+        parse_piece(m_parser, m_tree, 0, m_buffer.size());
+        notify(old_tree);
+    }
+    // Cold parse on worker threads: the document is cut at blank lines between top
+    // level declarations and each piece is parsed by its own parser. A piece whose
+    // errors touch a cut may have been cut inside a declaration, the two pieces
+    // around that cut are parsed again together, once. Any other error, or one
+    // left after the merge, sends the whole document to parse(). So does an
+    // existing tree or a small document.
+    void parse_parallel(unsigned threads = std::thread::hardware_concurrency()) {
+        TRACE_SCOPE("ASTBuffer::parse_parallel");
+        uint32_t size = m_buffer.size();
+        if (!m_tree.empty() || threads < 2 || size < 2 * parallel_piece_length) {
+            parse();
+            return;
+        }
+        uint32_t piece_length = size / (threads * 4);
+        DeclSplitter<char_t> splitter(piece_length > parallel_piece_length ? piece_length : parallel_piece_length);
+        m_buffer.iter_range(0, size, [&](const char_t *str, size_t length) {
+            splitter.feed(str, length);
+        });
+        std::vector<uint32_t> points = {0};
+        points.insert(points.end(), splitter.points().begin(), splitter.points().end());
+        points.push_back(size);
+        size_t count = points.size() - 1;
+        if (count < 2) {
+            parse();
+            return;
+        }
+        std::vector<ts::Tree> trees(count);
+        std::atomic<size_t> next(0);
+        auto work = [&]() {
+            ts::Parser parser(m_parser.language());
+            parser.set_limits(m_parser.limits());
+            for (size_t index; (index = next++) < count;) {
+                parse_piece(parser, trees[index], points[index], points[index + 1]);
             }
-            read_byte = sizeof(char_t);
-            return &m_buffer[byte / sizeof(char_t)];
-        }, sizeof(char_t) == 1 ? TSInputEncodingUTF8 : TSInputEncodingUTF16);
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min<size_t>(threads, count); ++i) {
+            workers.emplace_back(work);
+        }
+        work();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        for (size_t i = 0; i < trees.size(); ++i) {
+            if (!trees[i].root().has_error()) {
+                continue;
+            }
+            size_t first;
+            if (i + 1 < trees.size() && error_at_cut(trees[i].root(), true)) {
+                first = i;
+            } else if (i > 0 && error_at_cut(trees[i].root(), false)) {
+                first = i - 1;
+            } else {
+                trees.clear();
+                parse();
+                return;
+            }
+            ts::Tree merged;
+            parse_piece(m_parser, merged, points[first], points[first + 2]);
+            // a merge of the last two pieces is already the whole document
+            if (merged.root().has_error() && trees.size() > 2) {
+                trees.clear();
+                parse();
+                return;
+            }
+            trees[first] = std::move(merged);
+            trees.erase(trees.begin() + first + 1);
+            points.erase(points.begin() + first + 1);
+            i = first;
+        }
+        m_tree = ts::Tree::join(trees);
+        ts::Tree none;
+        notify(none);
+    }
+    // Lay the tree out contiguously after many reparses, call it when idle
+    void compact() {
+        if (!m_tree.empty()) {
+            m_tree.compact();
+            // the cached tokens would keep the old slabs alive
+            m_parser.reset();
+        }
     }
     void dump() {
         auto print_intent = [](int num) {
@@ -151,19 +334,68 @@ public:
         }
     }
 private:
-    void full_parse() {
-        typename buffer_t::Iterator iter;
-        m_parser.parse(m_tree, [&](uint32_t byte, TSPoint point, uint32_t &read) -> const char * {
-            if (iter.empty()) {
-                iter = m_buffer.iter(byte, m_buffer.size());
+    void edit_tree(const TSInputEdit &input) {
+        m_tree.edit(input);
+        if (!m_live_queries.empty()) {
+            m_edits.push_back(input);
+        }
+    }
+    void notify(ts::Tree &old_tree) {
+        for (auto *query : m_live_queries) {
+            query->reparsed(old_tree, m_edits);
+        }
+        m_edits.clear();
+    }
+    // Whether the errors of a piece reach its last (or first) top level node,
+    // where a cut through a declaration leaves them
+    static bool error_at_cut(ts::Node root, bool at_end) {
+        uint32_t count = root.count();
+        if (count == 0 || strcmp(root.type(), "ERROR") == 0) {
+            return true;
+        }
+        return root[at_end ? count - 1 : 0].has_error();
+    }
+    // Parse [start, end) of the buffer into tree, a piece starts at a line start
+    void parse_piece(ts::Parser &parser, ts::Tree &tree, uint32_t start, uint32_t end) {
+        auto chunk = m_buffer.cursor(start, start, end);
+        parser.parse(tree, [&](uint32_t byte, TSPoint, uint32_t &read_byte) -> const void * {
+            uint32_t pos = start + byte / sizeof(char_t);
+            if (chunk.position() != pos) {
+                chunk.seek(pos);
             }
-            if (iter.next()) {
-                read = iter.length();
-                std::cout << iter.string();
-                return iter.c_str();
+            if (!chunk.next()) {
+                return nullptr;
             }
-            return nullptr;
-        });
+            read_byte = chunk.length() * sizeof(char_t);
+            return chunk.c_str();
+        }, encoding());
+    }
+    // Edit the text without reparsing, the tree edit is appended to edits
+    void replace(uint32_t start, uint32_t end, const string_t &str, std::vector<TSInputEdit> &edits) {
+        TSInputEdit input;
+        if (!m_tree.empty()) {
+            input.start_byte = start * sizeof(char_t);
+            input.old_end_byte = end * sizeof(char_t);
+            input.new_end_byte = (start + str.length()) * sizeof(char_t);
+            input.start_point = get_point(start);
+            input.old_end_point = get_point(end);
+        }
+        if (start != end) {
+            if (m_session) {
+                m_session->record_erase(start, end);
+            }
+            m_buffer.erase(start, end);
+        }
+        if (!str.empty()) {
+            if (m_session) {
+                m_session->record_insert(start, str);
+            }
+            m_buffer.insert(start, str);
+        }
+        if (!m_tree.empty()) {
+            input.new_end_point = str.empty() ? input.start_point : get_point(start + str.length());
+            edits.push_back(input);
+        }
     }
 
 };
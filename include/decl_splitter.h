@@ -0,0 +1,233 @@
+﻿//
+// Created by Alex on 2020/5/12.
+//
+
+#ifndef GEDITOR_DECL_SPLITTER_H
+#define GEDITOR_DECL_SPLITTER_H
+#include <cstdint>
+#include <string>
+#include <vector>
+// Cheap pre-lexer for C like sources, it finds the lines that start a top level
+// declaration after a blank line: outside of brackets, comments, strings, raw
+// string literals and preprocessor conditionals. The text is fed chunk by chunk:
+//
+//     DeclSplitter<char> splitter(1 << 16);
+//     table.iter_range(0, table.size(), [&](const char *str, size_t length) {
+//         splitter.feed(str, length);
+//     });
+//     auto &points = splitter.points();
+//
+// A split point is only a guess, whoever parses the pieces has to confirm it.
+template <class char_t>
+class DeclSplitter {
+    enum State { Code, LineComment, BlockComment, String, RawDelimiter, RawString, Directive };
+    uint32_t m_min_distance;
+    std::vector<uint32_t> m_points;
+    uint32_t m_pos = 0;
+    uint32_t m_line_start = 0;
+    uint32_t m_last_point = 0;
+    uint32_t m_depth = 0;
+    uint32_t m_condition_depth = 0;
+    State m_state = Code;
+    char_t m_quote = 0;
+    char_t m_prev = 0;
+    bool m_escape = false;
+    bool m_number = false;
+    bool m_line_blank = true;
+    bool m_after_blank = false;
+    // the word before a quote, a raw string prefix like R or u8R
+    std::string m_word;
+    // d-char-sequence of the raw string and how much of )delimiter" was seen
+    std::string m_delimiter;
+    int m_delimiter_match = -1;
+    // directive name, continued to the next line by a trailing backslash
+    std::string m_directive;
+    bool m_directive_name = false;
+    bool m_continued = false;
+public:
+    // Points are at least min_distance characters apart
+    DeclSplitter(uint32_t min_distance) : m_min_distance(min_distance) {}
+    inline const std::vector<uint32_t> &points() { return m_points; }
+    void feed(const char_t *str, size_t length) {
+        for (size_t i = 0; i < length; ++i, ++m_pos) {
+            char_t ch = str[i];
+            if (ch == '\n') {
+                newline();
+                continue;
+            }
+            if (m_line_blank && !is_space(ch)) {
+                m_line_blank = false;
+                if (m_state == Code) {
+                    if (m_after_blank && m_depth == 0 && m_condition_depth == 0 &&
+                        m_line_start - m_last_point >= m_min_distance) {
+                        m_points.push_back(m_line_start);
+                        m_last_point = m_line_start;
+                    }
+                    if (ch == '#') {
+                        m_state = Directive;
+                        m_directive.clear();
+                        m_directive_name = true;
+                        m_prev = ch;
+                        continue;
+                    }
+                }
+            }
+            switch (m_state) {
+                case Code:
+                    ch = code(ch);
+                    break;
+                case LineComment:
+                    break;
+                case BlockComment:
+                    if (m_prev == '*' && ch == '/') {
+                        m_state = Code;
+                        ch = 0;
+                    }
+                    break;
+                case String:
+                    if (m_escape) {
+                        m_escape = false;
+                    } else if (ch == '\\') {
+                        m_escape = true;
+                    } else if (ch == m_quote) {
+                        m_state = Code;
+                    }
+                    break;
+                case RawDelimiter:
+                    raw_delimiter(ch);
+                    break;
+                case RawString:
+                    raw_string(ch);
+                    break;
+                case Directive:
+                    directive(ch);
+                    break;
+            }
+            m_prev = ch;
+        }
+    }
+private:
+    static inline bool is_space(char_t ch) {
+        return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\f' || ch == '\v';
+    }
+    static inline bool is_digit(char_t ch) { return ch >= '0' && ch <= '9'; }
+    static inline bool is_word(char_t ch) {
+        return is_digit(ch) || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
+    }
+    // The character to remember as the previous one
+    char_t code(char_t ch) {
+        if (is_word(ch)) {
+            if (!is_word(m_prev)) {
+                m_number = is_digit(ch);
+                m_word.clear();
+            }
+            if (m_word.size() < 4) {
+                m_word += (char) ch;
+            }
+        } else if (ch != '\'' && ch != '.') {
+            m_number = false;
+        }
+        switch (ch) {
+            case '{': case '(': case '[':
+                m_depth++;
+                break;
+            case '}': case ')': case ']':
+                if (m_depth > 0) {
+                    m_depth--;
+                }
+                break;
+            case '\'':
+            case '"':
+                if (ch == '"' && is_word(m_prev) &&
+                    (m_word == "R" || m_word == "LR" || m_word == "uR" || m_word == "UR" || m_word == "u8R")) {
+                    m_state = RawDelimiter;
+                    m_delimiter.clear();
+                    break;
+                }
+                // a digit separator like 1'000 doesn't open a literal
+                if (ch == '"' || !m_number) {
+                    m_state = String;
+                    m_quote = ch;
+                    m_escape = false;
+                }
+                break;
+            case '/':
+                if (m_prev == '/') {
+                    m_state = LineComment;
+                }
+                break;
+            case '*':
+                if (m_prev == '/') {
+                    m_state = BlockComment;
+                    return 0;
+                }
+                break;
+            default:
+                break;
+        }
+        return ch;
+    }
+    // R"delimiter( opens the raw string, a delimiter that can't be one was
+    // an ordinary string
+    void raw_delimiter(char_t ch) {
+        if (ch == '(') {
+            m_state = RawString;
+            m_delimiter_match = -1;
+        } else if (ch == ')' || ch == '\\' || ch == '"' || is_space(ch) || m_delimiter.size() == 16) {
+            m_state = ch == '"' ? Code : String;
+            m_quote = '"';
+            m_escape = ch == '\\';
+        } else {
+            m_delimiter += (char) ch;
+        }
+    }
+    // Newlines, quotes and backslashes are text up to )delimiter"
+    void raw_string(char_t ch) {
+        if (m_delimiter_match == (int) m_delimiter.size() && ch == '"') {
+            m_state = Code;
+        } else if (m_delimiter_match >= 0 && m_delimiter_match < (int) m_delimiter.size() &&
+                   ch == (char_t) m_delimiter[m_delimiter_match]) {
+            m_delimiter_match++;
+        } else {
+            m_delimiter_match = ch == ')' ? 0 : -1;
+        }
+    }
+    void directive(char_t ch) {
+        if (m_directive_name) {
+            if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')) {
+                m_directive += (char) ch;
+            } else if (!is_space(ch) || !m_directive.empty()) {
+                m_directive_name = false;
+            }
+        }
+        if (!is_space(ch)) {
+            m_continued = ch == '\\';
+        }
+    }
+    void newline() {
+        if (m_state == Directive) {
+            if (m_continued) {
+                m_continued = false;
+            } else {
+                if (m_directive == "if" || m_directive == "ifdef" || m_directive == "ifndef") {
+                    m_condition_depth++;
+                } else if (m_directive == "endif" && m_condition_depth > 0) {
+                    m_condition_depth--;
+                }
+                m_state = Code;
+            }
+        } else if (m_state == LineComment || m_state == String || m_state == RawDelimiter) {
+            // an unterminated literal doesn't run past its line
+            m_state = Code;
+        } else if (m_state == RawString) {
+            m_delimiter_match = -1;
+        }
+        m_after_blank = m_line_blank;
+        m_line_blank = true;
+        m_line_start = m_pos + 1;
+        m_prev = '\n';
+        m_number = false;
+    }
+};
+
+#endif //GEDITOR_DECL_SPLITTER_H
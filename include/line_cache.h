@@ -0,0 +1,176 @@
+﻿//
+// Created by Alex on 2020/5/9.
+//
+
+#ifndef GEDITOR_LINE_CACHE_H
+#define GEDITOR_LINE_CACHE_H
+#include <origin.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+// On-disk cache of origin line indexes, one file per origin path in the cache
+// directory. A cache file is only used when the size, mtime and sampled hash of
+// the origin still match and its newline offsets rise within the origin. The
+// offsets are then mapped directly into the table:
+//
+//     const uint32_t *lines; size_t count;
+//     if (cache.lookup<char>(path, origin, lines, count)) {
+//         table.append_origin(map, size, lines, count);
+//     } else {
+//         auto iter = table.append_origin(map, size);
+//         auto &index = table.line_index(iter->buffer);
+//         cache.store<char>(path, origin, index.begin(), index.size());
+//     }
+//
+// The cache must outlive every table using one of its mappings.
+class LineCache {
+    constexpr static uint32_t cache_magic = 0x58444E4C; // LNDX
+    constexpr static uint32_t cache_version = 1;
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t char_size;
+        uint32_t path_length;
+        uint64_t size;
+        int64_t mtime;
+        uint64_t hash;
+        uint64_t line_count;
+    };
+    struct Job {
+        std::string file;
+        std::string path;
+        Header header;
+        std::vector<uint32_t> lines;
+    };
+    std::string m_directory;
+    std::vector<std::unique_ptr<Origin>> m_mappings;
+    // Writes are queued for one worker, which exits once the queue is empty
+    std::deque<Job> m_jobs;
+    std::thread m_worker;
+    bool m_running = false;
+    std::mutex m_mutex;
+    std::condition_variable m_idle;
+public:
+    LineCache(const std::string &directory) : m_directory(directory) {}
+    LineCache(const LineCache &rhs) = delete;
+    ~LineCache() {
+        wait();
+    }
+    std::string cache_path(const std::string &path) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (auto ch : path) {
+            hash = (hash ^ (uint8_t) ch) * 1099511628211ULL;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.lines", (unsigned long long) hash);
+        return m_directory + "/" + name;
+    }
+    // Map the cached line index of an origin, false if missing or stale
+    template <class char_t>
+    bool lookup(const std::string &path, Origin &origin, const uint32_t *&lines, size_t &line_count) {
+        auto mapping = std::make_unique<Origin>(cache_path(path).c_str());
+        auto *base = (const char *) mapping->ptr();
+        if (!base || mapping->size() < sizeof(Header)) {
+            return false;
+        }
+        Header header;
+        memcpy(&header, base, sizeof(header));
+        size_t offset = sizeof(header) + header.path_length;
+        offset += (8 - offset % 8) % 8;
+        if (header.magic != cache_magic || header.version != cache_version ||
+            header.char_size != sizeof(char_t) || header.size != origin.size() ||
+            header.mtime != origin.mtime() || offset > mapping->size() ||
+            header.line_count > (mapping->size() - offset) / sizeof(uint32_t) ||
+            path.compare(0, std::string::npos, base + sizeof(header), header.path_length) != 0 ||
+            header.hash != origin.hash()) {
+            return false;
+        }
+        // the offsets are newline positions, so they must rise inside the origin
+        auto *offsets = (const uint32_t *) (base + offset);
+        size_t length = origin.size() / sizeof(char_t);
+        if (header.line_count > length ||
+            (header.line_count && offsets[header.line_count - 1] >= length)) {
+            return false;
+        }
+        for (size_t index = 1; index < header.line_count; ++index) {
+            if (offsets[index] <= offsets[index - 1]) {
+                return false;
+            }
+        }
+        lines = offsets;
+        line_count = header.line_count;
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_mappings.push_back(std::move(mapping));
+        return true;
+    }
+    // Write the line index of an origin on the background worker
+    template <class char_t>
+    void store(const std::string &path, Origin &origin, const uint32_t *lines, size_t line_count) {
+        Header header = {cache_magic, cache_version, sizeof(char_t), (uint32_t) path.length(),
+                         origin.size(), origin.mtime(), origin.hash(), line_count};
+        Job job{cache_path(path), path, header, std::vector<uint32_t>(lines, lines + line_count)};
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_jobs.push_back(std::move(job));
+        if (!m_running) {
+            // the last worker has left its loop, it only has to exit
+            if (m_worker.joinable()) {
+                m_worker.join();
+            }
+            m_running = true;
+            m_worker = std::thread(&LineCache::run, this);
+        }
+    }
+    // Block until every pending cache write has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this] { return !m_running; });
+        if (m_worker.joinable()) {
+            m_worker.join();
+        }
+    }
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_jobs.empty()) {
+            Job job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            lock.unlock();
+            write(job.file, job.header, job.path, job.lines);
+            lock.lock();
+        }
+        m_running = false;
+        m_idle.notify_all();
+    }
+    static void write(const std::string &file, const Header &header,
+                      const std::string &path, const std::vector<uint32_t> &lines) {
+        std::string temp = file + ".tmp";
+        FILE *fp = fopen(temp.c_str(), "wb");
+        if (!fp) {
+            return;
+        }
+        static const char zeros[8] = {0};
+        size_t offset = sizeof(header) + path.length();
+        fwrite(&header, sizeof(header), 1, fp);
+        fwrite(path.data(), 1, path.length(), fp);
+        fwrite(zeros, 1, (8 - offset % 8) % 8, fp);
+        fwrite(lines.data(), sizeof(uint32_t), lines.size(), fp);
+        bool success = !ferror(fp);
+        fclose(fp);
+#if WIN32
+        success = success && MoveFileExA(temp.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+        success = success && rename(temp.c_str(), file.c_str()) == 0;
+#endif
+        if (!success) {
+            remove(temp.c_str());
+        }
+    }
+};
+
+#endif //GEDITOR_LINE_CACHE_H
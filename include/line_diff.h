@@ -0,0 +1,198 @@
+﻿//
+// Created by Alex on 2020/5/10.
+//
+
+#ifndef GEDITOR_LINE_DIFF_H
+#define GEDITOR_LINE_DIFF_H
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+// Compare blocks with memcmp (vectorized by the C library), then scan the differing block
+template <class char_t>
+inline size_t mismatch_forward(const char_t *lhs, const char_t *rhs, size_t length) {
+    constexpr size_t block = 64;
+    size_t index = 0;
+    while (index + block <= length && memcmp(lhs + index, rhs + index, block * sizeof(char_t)) == 0) {
+        index += block;
+    }
+    while (index < length && lhs[index] == rhs[index]) {
+        index++;
+    }
+    return index;
+}
+// Number of equal characters before lhs_end and rhs_end
+template <class char_t>
+inline size_t mismatch_backward(const char_t *lhs_end, const char_t *rhs_end, size_t length) {
+    constexpr size_t block = 64;
+    size_t index = 0;
+    while (index + block <= length &&
+           memcmp(lhs_end - index - block, rhs_end - index - block, block * sizeof(char_t)) == 0) {
+        index += block;
+    }
+    while (index < length && lhs_end[-1 - (std::ptrdiff_t) index] == rhs_end[-1 - (std::ptrdiff_t) index]) {
+        index++;
+    }
+    return index;
+}
+// Line level Myers diff (linear space, middle snake bisection)
+template <class char_t>
+class LineDiff {
+public:
+    // Characters [start, end) of the old text are replaced by [new_start, new_end) of the new text
+    struct Hunk {
+        size_t start;
+        size_t end;
+        size_t new_start;
+        size_t new_end;
+    };
+    static std::vector<Hunk> diff(const char_t *old_text, size_t old_length,
+                                  const char_t *new_text, size_t new_length) {
+        LineDiff differ;
+        differ.split(old_text, old_length, differ.m_old, differ.m_old_starts);
+        differ.split(new_text, new_length, differ.m_new, differ.m_new_starts);
+        differ.compare(0, differ.m_old.size(), 0, differ.m_new.size());
+        std::vector<Hunk> hunks;
+        for (auto &hunk : differ.m_hunks) {
+            Hunk result = {differ.m_old_starts[hunk.start], differ.m_old_starts[hunk.end],
+                           differ.m_new_starts[hunk.new_start], differ.m_new_starts[hunk.new_end]};
+            if (!hunks.empty() && hunks.back().end == result.start && hunks.back().new_end == result.new_start) {
+                hunks.back().end = result.end;
+                hunks.back().new_end = result.new_end;
+            } else {
+                hunks.push_back(result);
+            }
+        }
+        return hunks;
+    }
+private:
+    struct Line {
+        const char_t *ptr;
+        size_t length;
+        bool operator==(const Line &rhs) const {
+            return length == rhs.length && memcmp(ptr, rhs.ptr, length * sizeof(char_t)) == 0;
+        }
+    };
+    struct LineHash {
+        size_t operator()(const Line &line) const {
+            size_t hash = 14695981039346656037ULL;
+            for (size_t i = 0; i < line.length; ++i) {
+                hash = (hash ^ (size_t) line.ptr[i]) * 1099511628211ULL;
+            }
+            return hash;
+        }
+    };
+    std::unordered_map<Line, int, LineHash> m_ids;
+    std::vector<int> m_old, m_new;
+    std::vector<size_t> m_old_starts, m_new_starts;
+    std::vector<Hunk> m_hunks; // in lines
+    void split(const char_t *text, size_t length, std::vector<int> &ids, std::vector<size_t> &starts) {
+        size_t start = 0;
+        for (size_t index = 0; index <= length; ++index) {
+            if (index == length || text[index] == char_t('\n')) {
+                size_t end = index == length ? index : index + 1;
+                if (end == start) {
+                    break;
+                }
+                auto result = m_ids.emplace(Line{text + start, end - start}, (int) m_ids.size());
+                ids.push_back(result.first->second);
+                starts.push_back(start);
+                start = end;
+            }
+        }
+        starts.push_back(length);
+    }
+    void add(size_t start, size_t end, size_t new_start, size_t new_end) {
+        if (start == end && new_start == new_end) {
+            return;
+        }
+        if (!m_hunks.empty() && m_hunks.back().end == start && m_hunks.back().new_end == new_start) {
+            m_hunks.back().end = end;
+            m_hunks.back().new_end = new_end;
+            return;
+        }
+        m_hunks.push_back({start, end, new_start, new_end});
+    }
+    void compare(size_t a0, size_t a1, size_t b0, size_t b1) {
+        while (a0 < a1 && b0 < b1 && m_old[a0] == m_new[b0]) {
+            a0++, b0++;
+        }
+        while (a0 < a1 && b0 < b1 && m_old[a1 - 1] == m_new[b1 - 1]) {
+            a1--, b1--;
+        }
+        if (a0 == a1 || b0 == b1) {
+            add(a0, a1, b0, b1);
+            return;
+        }
+        size_t x, y;
+        if (bisect(a0, a1, b0, b1, x, y)) {
+            compare(a0, x, b0, y);
+            compare(x, a1, y, b1);
+        } else {
+            add(a0, a1, b0, b1);
+        }
+    }
+    bool bisect(size_t a0, size_t a1, size_t b0, size_t b1, size_t &split_x, size_t &split_y) {
+        const int *a = m_old.data() + a0, *b = m_new.data() + b0;
+        long n = a1 - a0, m = b1 - b0;
+        long max_d = (n + m + 1) / 2, offset = max_d, length = 2 * max_d + 2;
+        std::vector<long> v1(length, -1), v2(length, -1);
+        v1[offset + 1] = 0;
+        v2[offset + 1] = 0;
+        long delta = n - m;
+        bool front = delta % 2 != 0;
+        long k1_start = 0, k1_end = 0, k2_start = 0, k2_end = 0;
+        for (long d = 0; d < max_d; ++d) {
+            for (long k1 = -d + k1_start; k1 <= d - k1_end; k1 += 2) {
+                long k1_offset = offset + k1;
+                long x1 = (k1 == -d || (k1 != d && v1[k1_offset - 1] < v1[k1_offset + 1])) ?
+                          v1[k1_offset + 1] : v1[k1_offset - 1] + 1;
+                long y1 = x1 - k1;
+                while (x1 < n && y1 < m && a[x1] == b[y1]) {
+                    x1++, y1++;
+                }
+                v1[k1_offset] = x1;
+                if (x1 > n) {
+                    k1_end += 2;
+                } else if (y1 > m) {
+                    k1_start += 2;
+                } else if (front) {
+                    long k2_offset = offset + delta - k1;
+                    if (k2_offset >= 0 && k2_offset < length && v2[k2_offset] != -1 && x1 >= n - v2[k2_offset]) {
+                        split_x = a0 + x1, split_y = b0 + y1;
+                        return true;
+                    }
+                }
+            }
+            for (long k2 = -d + k2_start; k2 <= d - k2_end; k2 += 2) {
+                long k2_offset = offset + k2;
+                long x2 = (k2 == -d || (k2 != d && v2[k2_offset - 1] < v2[k2_offset + 1])) ?
+                          v2[k2_offset + 1] : v2[k2_offset - 1] + 1;
+                long y2 = x2 - k2;
+                while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1]) {
+                    x2++, y2++;
+                }
+                v2[k2_offset] = x2;
+                if (x2 > n) {
+                    k2_end += 2;
+                } else if (y2 > m) {
+                    k2_start += 2;
+                } else if (!front) {
+                    long k1_offset = offset + delta - k2;
+                    if (k1_offset >= 0 && k1_offset < length && v1[k1_offset] != -1) {
+                        long x1 = v1[k1_offset];
+                        long y1 = offset + x1 - k1_offset;
+                        if (x1 >= n - x2) {
+                            split_x = a0 + x1, split_y = b0 + y1;
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+        return false;
+    }
+};
+
+#endif //GEDITOR_LINE_DIFF_H
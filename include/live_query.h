@@ -0,0 +1,366 @@
+﻿//
+// Created by Alex on 2020/5/13.
+//
+
+#ifndef GEDITOR_LIVE_QUERY_H
+#define GEDITOR_LIVE_QUERY_H
+#include <tree_sitter.h>
+#include <trace.h>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <vector>
+template <class char_t, class string_t>
+class ASTBuffer;
+// A query whose match set follows an ASTBuffer. After each reparse only the
+// ranges that changed are queried again, widened to the matches they touch,
+// and the listener hears of the matches removed and added:
+//
+//     LiveQuery<char> outline(ast, query, [&](const auto &match, bool added) {
+//         ...
+//     });
+//
+// Matches are kept by value, their nodes don't outlive the tree. A match the
+// edited text touches is reported as removed and added again, its captured
+// text may have changed even when the nodes look the same. An update queries
+// the changed ranges and the nodes around them, the stored matches past the
+// edit only have their positions moved.
+template <class char_t = char, class string_t = std::basic_string<char_t>>
+class LiveQuery {
+public:
+    struct Capture {
+        uint32_t index;
+        TSSymbol symbol;
+        uint32_t start_byte;
+        uint32_t end_byte;
+        inline bool operator==(const Capture &rhs) const {
+            return index == rhs.index && symbol == rhs.symbol &&
+                   start_byte == rhs.start_byte && end_byte == rhs.end_byte;
+        }
+        inline bool operator<(const Capture &rhs) const {
+            if (start_byte != rhs.start_byte) return start_byte < rhs.start_byte;
+            if (end_byte != rhs.end_byte) return end_byte < rhs.end_byte;
+            if (index != rhs.index) return index < rhs.index;
+            return symbol < rhs.symbol;
+        }
+    };
+    struct Match {
+        uint32_t pattern_index;
+        // extent of the captures
+        uint32_t start_byte;
+        uint32_t end_byte;
+        std::vector<Capture> captures;
+        inline bool operator==(const Match &rhs) const {
+            return pattern_index == rhs.pattern_index && captures == rhs.captures;
+        }
+        inline bool operator<(const Match &rhs) const {
+            if (start_byte != rhs.start_byte) return start_byte < rhs.start_byte;
+            if (end_byte != rhs.end_byte) return end_byte < rhs.end_byte;
+            if (pattern_index != rhs.pattern_index) return pattern_index < rhs.pattern_index;
+            return captures < rhs.captures;
+        }
+    };
+    using buffer_t = ASTBuffer<char_t, string_t>;
+    using listener_t = std::function<void(const Match &match, bool added)>;
+private:
+    // Closed byte range, a match ending where an edit starts still touches it
+    struct Range {
+        uint32_t start;
+        uint32_t end;
+    };
+    buffer_t &m_buffer;
+    ts::Query &m_query;
+    listener_t m_listener;
+    // how far above a node of each symbol its match may start
+    std::vector<uint32_t> m_symbol_depths;
+    // sorted by position
+    std::vector<Match> m_matches;
+    uint32_t m_queried_bytes = 0;
+public:
+    // The current matches of the buffer are reported as added right away
+    LiveQuery(buffer_t &buffer, ts::Query &query, listener_t listener = nullptr) :
+            m_buffer(buffer), m_query(query), m_listener(std::move(listener)) {
+        uint32_t symbol_count = m_buffer.parser().language().symbol_count();
+        for (TSSymbol symbol = 0; symbol < symbol_count; ++symbol) {
+            m_symbol_depths.push_back(m_query.max_depth(symbol));
+        }
+        m_buffer.attach(this);
+        if (!m_buffer.tree().empty()) {
+            ts::Tree none;
+            reparsed(none, {});
+        }
+    }
+    LiveQuery(const LiveQuery &rhs) = delete;
+    ~LiveQuery() {
+        m_buffer.detach(this);
+    }
+    inline const std::vector<Match> &matches() const { return m_matches; }
+    // Bytes queried again by the last update
+    inline uint32_t queried_bytes() const { return m_queried_bytes; }
+    // Called by the buffer after a parse with the edited tree it parsed from, empty
+    // for a fresh tree, and the text edits since the last parse in the order made
+    void reparsed(ts::Tree &old_tree, const std::vector<TSInputEdit> &edits) {
+        TRACE_SCOPE("LiveQuery::reparsed");
+        std::vector<Range> dirty, edited;
+        if (old_tree.empty()) {
+            dirty.push_back({0, UINT32_MAX});
+        } else {
+            for (auto &edit : edits) {
+                for (auto &match : m_matches) {
+                    shift(match, edit);
+                }
+                for (auto &range : edited) {
+                    range.start = shift(range.start, edit);
+                    range.end = shift(range.end, edit);
+                }
+                edited.push_back({edit.start_byte, edit.new_end_byte});
+            }
+            dirty = edited;
+            for (auto &range : m_buffer.tree().changed_ranges(old_tree)) {
+                dirty.push_back({range.start_byte, range.end_byte});
+            }
+        }
+        merge(dirty);
+        merge(edited);
+        m_queried_bytes = 0;
+        if (dirty.empty()) {
+            return;
+        }
+        // a stored match touching a range starts at most this far before it
+        uint32_t longest = 0;
+        for (auto &match : m_matches) {
+            longest = std::max(longest, match.end_byte - match.start_byte);
+        }
+
+        // Grow the dirty ranges over the kept and the fresh matches they touch until
+        // every match crossing them lies inside, then query them once more. The
+        // matches the windows hold outside the dirty ranges stay as they were.
+        std::vector<Match> fresh;
+        for (;;) {
+            bool grown;
+            do {
+                grown = false;
+                for (size_t i = 0; i < dirty.size(); ++i) {
+                    for (auto iter = first_near(dirty[i].start, longest);
+                         iter != m_matches.end() && iter->start_byte <= dirty[i].end; ++iter) {
+                        grown |= cover(dirty, *iter);
+                    }
+                }
+                merge(dirty);
+            } while (grown);
+            std::vector<Range> windows;
+            for (auto &range : dirty) {
+                windows.push_back(window(range));
+            }
+            merge(windows);
+            fresh.clear();
+            m_queried_bytes = 0;
+            for (auto &range : windows) {
+                query(range, fresh);
+            }
+            fresh.erase(std::remove_if(fresh.begin(), fresh.end(), [&](const Match &match) {
+                return !touches(dirty, match);
+            }), fresh.end());
+            grown = false;
+            for (auto &match : fresh) {
+                grown |= cover(dirty, match);
+            }
+            if (!grown) {
+                break;
+            }
+            merge(dirty);
+        }
+        // a match whose nodes cross two ranges comes from both
+        std::sort(fresh.begin(), fresh.end());
+        fresh.erase(std::unique(fresh.begin(), fresh.end()), fresh.end());
+
+        // Only the stored matches between the first and the last dirty range change.
+        // One equal to a fresh match outside the edited text is unchanged.
+        auto first = first_near(dirty.front().start, longest);
+        auto last = std::upper_bound(first, m_matches.end(), dirty.back().end, [](uint32_t pos, const Match &match) {
+            return pos < match.start_byte;
+        });
+        std::vector<Match> kept, removed;
+        std::vector<bool> unchanged(fresh.size(), false);
+        for (auto iter = first; iter != last; ++iter) {
+            auto &match = *iter;
+            if (!touches(dirty, match)) {
+                kept.push_back(std::move(match));
+                continue;
+            }
+            if (!touches(edited, match)) {
+                auto iter = std::lower_bound(fresh.begin(), fresh.end(), match);
+                if (iter != fresh.end() && *iter == match) {
+                    unchanged[iter - fresh.begin()] = true;
+                    continue;
+                }
+            }
+            removed.push_back(std::move(match));
+        }
+        if (m_listener) {
+            for (auto &match : removed) {
+                m_listener(match, false);
+            }
+            for (size_t i = 0; i < fresh.size(); ++i) {
+                if (!unchanged[i]) {
+                    m_listener(fresh[i], true);
+                }
+            }
+        }
+        std::vector<Match> middle;
+        middle.reserve(kept.size() + fresh.size());
+        std::merge(std::make_move_iterator(kept.begin()), std::make_move_iterator(kept.end()),
+                   std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()),
+                   std::back_inserter(middle));
+        auto offset = first - m_matches.begin();
+        m_matches.erase(first, last);
+        m_matches.insert(m_matches.begin() + offset, std::make_move_iterator(middle.begin()),
+                         std::make_move_iterator(middle.end()));
+    }
+private:
+    // A position after the edit moves with it, one inside it goes to its new end
+    static inline uint32_t shift(uint32_t pos, const TSInputEdit &edit) {
+        if (pos >= edit.old_end_byte) {
+            return pos - edit.old_end_byte + edit.new_end_byte;
+        }
+        if (pos > edit.start_byte) {
+            return std::min(pos, edit.new_end_byte);
+        }
+        return pos;
+    }
+    static void shift(Match &match, const TSInputEdit &edit) {
+        if (match.end_byte < edit.start_byte) {
+            return;
+        }
+        match.start_byte = shift(match.start_byte, edit);
+        match.end_byte = shift(match.end_byte, edit);
+        for (auto &capture : match.captures) {
+            capture.start_byte = shift(capture.start_byte, edit);
+            capture.end_byte = shift(capture.end_byte, edit);
+        }
+    }
+    // The first stored match that can touch a range from pos on
+    typename std::vector<Match>::iterator first_near(uint32_t pos, uint32_t longest) {
+        pos = pos > longest ? pos - longest : 0;
+        return std::lower_bound(m_matches.begin(), m_matches.end(), pos, [](const Match &match, uint32_t pos) {
+            return match.start_byte < pos;
+        });
+    }
+    // Sort the ranges and join the ones that overlap or touch
+    static void merge(std::vector<Range> &ranges) {
+        if (ranges.empty()) {
+            return;
+        }
+        std::sort(ranges.begin(), ranges.end(), [](const Range &lhs, const Range &rhs) {
+            return lhs.start < rhs.start;
+        });
+        size_t count = 0;
+        for (size_t i = 1; i < ranges.size(); ++i) {
+            if (ranges[i].start <= ranges[count].end) {
+                ranges[count].end = std::max(ranges[count].end, ranges[i].end);
+            } else {
+                ranges[++count] = ranges[i];
+            }
+        }
+        ranges.resize(count + 1);
+    }
+    // The first range ending at or after pos
+    static typename std::vector<Range>::const_iterator find(const std::vector<Range> &ranges, uint32_t pos) {
+        return std::lower_bound(ranges.begin(), ranges.end(), pos, [](const Range &range, uint32_t pos) {
+            return range.end < pos;
+        });
+    }
+    static bool touches(const std::vector<Range> &ranges, const Match &match) {
+        auto iter = find(ranges, match.start_byte);
+        return iter != ranges.end() && iter->start <= match.end_byte;
+    }
+    // Widen the ranges the match touches over it, true if one grew
+    static bool cover(std::vector<Range> &ranges, const Match &match) {
+        auto iter = find(ranges, match.start_byte);
+        if (iter == ranges.end() || iter->start > match.end_byte) {
+            return false;
+        }
+        auto &range = ranges[iter - ranges.begin()];
+        bool grown = match.start_byte < range.start || match.end_byte > range.end;
+        range.start = std::min(range.start, match.start_byte);
+        range.end = std::max(range.end, match.end_byte);
+        return grown;
+    }
+    // A ranged cursor only sees the matches whose nodes all cross its range. A
+    // match touching the range holds the smallest node around it or one next to
+    // it, or one of their ancestors, as every node between the match's root and
+    // the nodes it touches with is matched. The root is at most the depth of that
+    // node's symbol in the query above it.
+    Range window(const Range &range) {
+        ts::Node root = m_buffer.tree().root();
+        uint32_t end = std::min(range.end, root.end_byte());
+        uint32_t start = std::min(range.start, end);
+        Range window{start, end};
+        std::vector<ts::Node> path;
+        auto climb = [&](ts::Node node) {
+            path.clear();
+            uint32_t height = 0;
+            for (; !node.empty(); node = node.parent()) {
+                uint32_t depth = symbol_depth(node.symbol());
+                if (depth != UINT32_MAX) {
+                    height = std::max<uint32_t>(height, path.size() + depth);
+                }
+                path.push_back(node);
+            }
+            auto &top = path[std::min<size_t>(height, path.size() - 1)];
+            window.start = std::min(window.start, top.start_byte());
+            window.end = std::max(window.end, top.end_byte());
+        };
+        // a neighbour holding the range is an ancestor of the inner node
+        auto holds = [&](const ts::Node &node) {
+            return node.start_byte() <= start && node.end_byte() >= end;
+        };
+        climb(root.descendant_for_byte_range(start, end));
+        if (start) {
+            ts::Node left = root.descendant_for_byte_range(start - 1, start);
+            if (!holds(left)) {
+                climb(left);
+            }
+        }
+        ts::Node right = root.descendant_for_byte_range(end, end + 1);
+        if (!holds(right)) {
+            climb(right);
+        }
+        return window;
+    }
+    inline uint32_t symbol_depth(TSSymbol symbol) {
+        return symbol < m_symbol_depths.size() ? m_symbol_depths[symbol] : m_query.max_depth(symbol);
+    }
+    void query(const Range &range, std::vector<Match> &matches) {
+        // the cursor skips the nodes that end at its start or start at its end,
+        // the range is closed so both ends are widened by a byte
+        uint32_t start = range.start ? range.start - 1 : 0;
+        uint32_t end = range.end == UINT32_MAX ? UINT32_MAX : range.end + 1;
+        ts::Query::Cursor cursor(ts::CursorPool::global());
+        cursor.set_byte_range(start, end);
+        m_query.exec(cursor, m_buffer.tree().root());
+        uint32_t size = m_buffer.length() * sizeof(char_t);
+        m_queried_bytes += std::min(end, size) - std::min(start, size);
+        while (next_match(cursor, std::integral_constant<bool, sizeof(char_t) == 1>())) {
+            auto &ts_match = cursor.match();
+            if (ts_match.capture_count == 0) {
+                continue;
+            }
+            Match match{ts_match.pattern_index, UINT32_MAX, 0, {}};
+            for (uint16_t i = 0; i < ts_match.capture_count; ++i) {
+                TSNode node = ts_match.captures[i].node;
+                Capture capture{ts_match.captures[i].index, ts_node_symbol(node),
+                                ts_node_start_byte(node), ts_node_end_byte(node)};
+                match.start_byte = std::min(match.start_byte, capture.start_byte);
+                match.end_byte = std::max(match.end_byte, capture.end_byte);
+                match.captures.push_back(capture);
+            }
+            matches.push_back(std::move(match));
+        }
+    }
+    // The text predicates need a UTF-8 buffer, wider ones get the raw matches
+    inline bool next_match(ts::Query::Cursor &cursor, std::true_type) { return cursor.next_match(m_buffer); }
+    inline bool next_match(ts::Query::Cursor &cursor, std::false_type) { return cursor.next_match(); }
+};
+
+#endif //GEDITOR_LIVE_QUERY_H
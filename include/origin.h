@@ -4,20 +4,25 @@
 
 #ifndef GEDITOR_ORIGIN_H
 #define GEDITOR_ORIGIN_H
+#include <cstdint>
+#include <cstddef>
 #if WIN32
 #include <Windows.h>
 #include <fileapi.h>
 #include <memoryapi.h>
 #else
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <unistd.h>
 #endif
 class Origin {
 #if WIN32
     HANDLE m_hFile, m_hMapping;
 #endif
     const void *m_pContent = nullptr;
-    size_t m_nSize;
+    size_t m_nSize = 0;
+    int64_t m_nTime = 0;
 public:
     Origin(const char *file) {
 #if WIN32
@@ -26,12 +31,23 @@ public:
         m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READWRITE, 0, 0, NULL);
         m_pContent = (const char *) MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
         m_nSize = GetFileSize(m_hFile, 0);
+        FILETIME time;
+        if (GetFileTime(m_hFile, NULL, NULL, &time)) {
+            m_nTime = ((int64_t) time.dwHighDateTime << 32) | time.dwLowDateTime;
+        }
 #else
         int fd = open(file, O_RDWR);
+        if (fd < 0) {
+            return;
+        }
         struct stat st;
         fstat(fd, &st);
         m_nSize = st.st_size;
-        m_pContent = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+        m_nTime = (int64_t) st.st_mtime;
+        if (m_nSize) {
+            void *ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            m_pContent = ptr == MAP_FAILED ? nullptr : ptr;
+        }
         close(fd);
 #endif
     }
@@ -41,11 +57,43 @@ public:
         CloseHandle(m_hMapping);
         CloseHandle(m_hFile);
 #else
-        munmap (m_pContent, m_nSize);
+        if (m_pContent) {
+            munmap((void *) m_pContent, m_nSize);
+        }
 #endif
     }
+    Origin(const Origin &rhs) = delete;
+    Origin &operator=(const Origin &rhs) = delete;
     const void *ptr() { return m_pContent; }
     size_t size() { return m_nSize; }
+    int64_t mtime() { return m_nTime; }
+    // FNV-1a over the size and a fixed number of evenly spaced samples,
+    // cheap enough to validate caches of very large files on open
+    uint64_t hash() {
+        constexpr size_t sample_count = 64;
+        constexpr size_t sample_size = 256;
+        uint64_t hash = 14695981039346656037ULL;
+        auto feed = [&](const uint8_t *data, size_t length) {
+            for (size_t i = 0; i < length; ++i) {
+                hash = (hash ^ data[i]) * 1099511628211ULL;
+            }
+        };
+        uint64_t size = m_nSize;
+        feed((const uint8_t *) &size, sizeof(size));
+        if (!m_pContent) {
+            return hash;
+        }
+        auto *content = (const uint8_t *) m_pContent;
+        if (m_nSize <= sample_count * sample_size) {
+            feed(content, m_nSize);
+            return hash;
+        }
+        size_t stride = (m_nSize - sample_size) / (sample_count - 1);
+        for (size_t i = 0; i < sample_count; ++i) {
+            feed(content + i * stride, sample_size);
+        }
+        return hash;
+    }
 };
 
 #endif //GEDITOR_ORIGIN_H
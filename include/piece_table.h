@@ -11,8 +11,13 @@
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <line_diff.h>
+#include <trace.h>
+template <class char_t, class string_t>
+class Session;
 template <class char_t = char, class string_t = std::basic_string<char_t>>
 class PieceTable {
+    friend class Session<char_t, string_t>;
 public:
     class Piece;
     constexpr static char_t char_lf = char_t('\n');
@@ -27,27 +32,50 @@ public:
     PieceTable() {
         m_buffers.resize(2);
     }
+    // Newline offsets of a buffer, owned or mapped from a session file
+    struct Lines {
+        std::vector<uint32_t> owned;
+        const uint32_t *mapped = nullptr;
+        size_t mapped_size = 0;
+        inline const uint32_t *begin() const { return mapped ? mapped : owned.data(); }
+        inline const uint32_t *end() const { return begin() + size(); }
+        inline size_t size() const { return mapped ? mapped_size : owned.size(); }
+        inline const uint32_t &operator[](const size_t &index) const { return begin()[index]; }
+        inline void push_back(uint32_t offset) { owned.push_back(offset); }
+        inline void map(const uint32_t *ptr, size_t count) {
+            owned.clear();
+            mapped = ptr;
+            mapped_size = count;
+        }
+    };
     struct Buffer {
         const char_t *map_ptr = nullptr;
+        size_t map_length = 0;
         // Append-Only Buffer
         std::unique_ptr<string_t> buffer;
         // Line index in buffer
-        std::vector<uint32_t> lines;
+        Lines lines;
         Buffer() {
             buffer = std::make_unique<string_t>();
         }
         Buffer(const char_t *ptr, size_t length) {
             set_map(ptr, length);
         }
+        Buffer(const char_t *ptr, size_t length, const uint32_t *line_ptr, size_t line_count) {
+            map_ptr = ptr;
+            map_length = length;
+            lines.map(line_ptr, line_count);
+        }
         inline void set_map(const char_t *ptr, size_t length) {
             map_ptr = ptr;
+            map_length = length;
             for (size_t index = 0; index < length; ++index) {
                 if (ptr[index] == char_lf) {
                     lines.push_back(index);
                 }
             }
         }
-        inline size_t size() { return buffer->size(); }
+        inline size_t size() { return map_ptr ? map_length : buffer->size(); }
         inline void append(const string_t &string) {
             size_t offset = buffer->size();
             buffer->append(string);
@@ -106,59 +134,143 @@ public:
             return *this;
         }
     };
-    class Iterator {
+    // Bidirectional cursor over the contiguous chunks of [begin, end), each step
+    // yields the part of one piece next to the position and moves over it
+    class Cursor {
     private:
-        PieceTable *m_piece = nullptr;
-        offset_t m_start;
-        iter_t iter_start;
-        iter_t iter_end;
-        iter_t iter;
-        offset_t m_remainder = 0;
+        PieceTable *m_table = nullptr;
+        // piece containing the position, end() at the end of the document
+        iter_t m_piece;
+        offset_t m_pos = 0;
+        offset_t m_begin = 0;
+        offset_t m_end = 0;
         const char_t *m_string = nullptr;
         size_t m_length = 0;
     public:
-        Iterator() = default;
-        Iterator(PieceTable *piece, offset_t start, offset_t end) : m_piece(piece) {
-            m_start = start;
-            m_remainder = end - start;
-            iter = iter_start = m_piece->upper_pos(start);
-            iter_end = m_piece->upper_pos(end);
+        Cursor() = default;
+        Cursor(PieceTable *table, offset_t pos, offset_t begin, offset_t end) :
+                m_table(table), m_begin(begin), m_end(end) {
+            seek(pos);
         }
-        inline bool empty() { return !m_piece; }
+        inline bool empty() { return !m_table; }
+        inline offset_t position() { return m_pos; }
         inline const char_t *c_str() { return m_string; }
         inline size_t length() { return m_length; }
         inline string_t string() { return string_t(m_string, m_length); }
+        inline void seek(offset_t pos) {
+            m_pos = std::min(std::max(pos, m_begin), m_end);
+            m_piece = m_pos >= m_table->size() ? m_table->m_pieces.end() : m_table->upper_pos(m_pos);
+        }
+        // Chunk from the position to the end of its piece, the position moves to its end
         inline bool next() {
-            if (m_remainder == 0) {
+            if (m_pos >= m_end || m_piece == m_table->m_pieces.end()) {
                 return false;
             }
-            if (iter_start == iter_end) {
-                offset_t offset = m_start - iter_start->left_length;
-                m_string = &m_piece->m_buffers[iter_start->buffer][iter_start->start + offset];
-                m_length = m_remainder;
-                m_remainder = 0;
-                return true;
-            }
-            if (iter == iter_start) {
-                offset_t offset = m_start - iter->left_length;
-                m_string = &m_piece->m_buffers[iter->buffer][iter->start + offset];
-                m_length = iter->length - offset;
-            } else if (iter == iter_end) {
-                m_string = &m_piece->m_buffers[iter->buffer][iter->start];
-                m_length = m_remainder;
-            } else {
-                m_string = &m_piece->m_buffers[iter->buffer][iter->start];
-                m_length = iter->length;
+            offset_t piece_end = m_piece->left_length + m_piece->length;
+            m_string = &m_table->m_buffers[m_piece->buffer][m_piece->start + m_pos - m_piece->left_length];
+            m_length = std::min(piece_end, m_end) - m_pos;
+            m_pos += m_length;
+            if (m_pos == piece_end) {
+                ++m_piece;
             }
-            iter++;
-            if (m_remainder >= m_length) {
-                m_remainder -= m_length;
-            } else {
-                m_remainder = 0;
+            return true;
+        }
+        // Chunk from the start of the piece before the position, the position moves to its start
+        inline bool prev() {
+            if (m_pos <= m_begin) {
+                return false;
             }
+            if (m_piece == m_table->m_pieces.end() || m_pos == m_piece->left_length) {
+                --m_piece;
+            }
+            offset_t start = std::max<offset_t>(m_piece->left_length, m_begin);
+            m_string = &m_table->m_buffers[m_piece->buffer][m_piece->start + start - m_piece->left_length];
+            m_length = m_pos - start;
+            m_pos = start;
             return true;
         }
     };
+    class Iterator {
+    private:
+        Cursor m_cursor;
+    public:
+        Iterator() = default;
+        Iterator(PieceTable *piece, offset_t start, offset_t end) : m_cursor(piece, start, start, end) {}
+        inline bool empty() { return m_cursor.empty(); }
+        inline const char_t *c_str() { return m_cursor.c_str(); }
+        inline size_t length() { return m_cursor.length(); }
+        inline string_t string() { return m_cursor.string(); }
+        inline bool next() { return m_cursor.next(); }
+    };
+    // Bidirectional iterator over the characters of [begin, end) across pieces,
+    // for algorithms like std::regex_search that want one range
+    class CharIterator {
+    private:
+        PieceTable *m_table = nullptr;
+        offset_t m_pos = 0;
+        offset_t m_begin = 0;
+        offset_t m_end = 0;
+        // chunk holding the position, [m_chunk_start, m_chunk_end) of the document
+        const char_t *m_chunk = nullptr;
+        offset_t m_chunk_start = 0;
+        offset_t m_chunk_end = 0;
+        inline void load() {
+            Cursor chunk(m_table, m_pos, m_begin, m_end);
+            if (chunk.next()) {
+                m_chunk = chunk.c_str();
+                m_chunk_end = chunk.position();
+                m_chunk_start = m_chunk_end - chunk.length();
+            } else {
+                m_chunk_start = m_chunk_end = m_pos;
+            }
+        }
+        // Stepping back loads the chunk that ends after the position
+        inline void load_back() {
+            Cursor chunk(m_table, m_pos + 1, m_begin, m_end);
+            chunk.prev();
+            m_chunk = chunk.c_str();
+            m_chunk_start = chunk.position();
+            m_chunk_end = m_chunk_start + chunk.length();
+        }
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = char_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const char_t *;
+        using reference = const char_t &;
+        CharIterator() = default;
+        CharIterator(PieceTable *table, offset_t pos, offset_t begin, offset_t end) :
+                m_table(table), m_pos(pos), m_begin(begin), m_end(end) {
+            load();
+        }
+        inline offset_t position() const { return m_pos; }
+        inline reference operator*() const { return m_chunk[m_pos - m_chunk_start]; }
+        inline pointer operator->() const { return &**this; }
+        inline CharIterator &operator++() {
+            if (++m_pos >= m_chunk_end) {
+                load();
+            }
+            return *this;
+        }
+        inline CharIterator operator++(int) {
+            CharIterator iter = *this;
+            ++*this;
+            return iter;
+        }
+        inline CharIterator &operator--() {
+            if (m_pos-- <= m_chunk_start) {
+                load_back();
+            }
+            return *this;
+        }
+        inline CharIterator operator--(int) {
+            CharIterator iter = *this;
+            --*this;
+            return iter;
+        }
+        inline bool operator==(const CharIterator &rhs) const { return m_pos == rhs.m_pos; }
+        inline bool operator!=(const CharIterator &rhs) const { return m_pos != rhs.m_pos; }
+    };
     size_t size() {
         if (m_pieces.empty()) {
             return 0;
@@ -248,30 +360,92 @@ public:
     Iterator iter(offset_t start, offset_t end) {
         return Iterator(this, start, end);
     }
+    Cursor cursor(offset_t pos) {
+        return Cursor(this, pos, 0, size());
+    }
+    Cursor cursor(offset_t pos, offset_t begin, offset_t end) {
+        return Cursor(this, pos, begin, end);
+    }
+    CharIterator chars(offset_t pos, offset_t begin, offset_t end) {
+        return CharIterator(this, pos, begin, end);
+    }
+    // The characters of [start, end) when they sit in one piece, nullptr otherwise
+    const char_t *contiguous(offset_t start, offset_t end) {
+        auto chunk = cursor(start, start, end);
+        if (!chunk.next() || chunk.position() != end) {
+            return nullptr;
+        }
+        return chunk.c_str();
+    }
+    // Whether [start, end) holds str, compared piece by piece without a copy
+    bool range_equal(offset_t start, offset_t end, const char_t *str, size_t length) {
+        if (end - start != length) {
+            return false;
+        }
+        auto chunk = cursor(start, start, end);
+        while (chunk.next()) {
+            if (mismatch_forward(chunk.c_str(), str, chunk.length()) < chunk.length()) {
+                return false;
+            }
+            str += chunk.length();
+        }
+        return true;
+    }
+    // Whether [start, end) and [other_start, other_end) hold the same characters
+    bool range_equal(offset_t start, offset_t end, offset_t other_start, offset_t other_end) {
+        if (end - start != other_end - other_start) {
+            return false;
+        }
+        auto chunk = cursor(start, start, end);
+        auto other = cursor(other_start, other_start, other_end);
+        size_t offset = 0, other_offset = 0;
+        bool more = chunk.next(), other_more = other.next();
+        while (more && other_more) {
+            size_t length = std::min(chunk.length() - offset, other.length() - other_offset);
+            if (mismatch_forward(chunk.c_str() + offset, other.c_str() + other_offset, length) < length) {
+                return false;
+            }
+            offset += length;
+            other_offset += length;
+            if (offset == chunk.length()) {
+                more = chunk.next();
+                offset = 0;
+            }
+            if (other_offset == other.length()) {
+                other_more = other.next();
+                other_offset = 0;
+            }
+        }
+        return true;
+    }
     void iter_range(offset_t start, offset_t end, iter_func func) {
-        auto iter_start = upper_pos(start);
-        auto iter_end = upper_pos(end);
-        offset_t offset = start - iter_start->left_length;
-        if (iter_start == iter_end) {
-            func(&m_buffers[iter_start->buffer][iter_start->start + offset], end - start);
-            return;
-        }
-        offset_t length = end - (iter_start->left_length + iter_start->length);
-        func(&m_buffers[iter_start->buffer][iter_start->start + offset],
-             iter_start->length - offset);
-        while (length > 0) {
-            iter_start++;
-            if (length > iter_start->length) {
-                func(&m_buffers[iter_start->buffer][iter_start->start], iter_start->length);
-                length -= iter_start->length;
-            } else {
-                func(&m_buffers[iter_start->buffer][iter_start->start], length);
-                length = 0;
+        auto chunk = cursor(start, start, end);
+        while (chunk.next()) {
+            func(chunk.c_str(), chunk.length());
+        }
+    }
+    // Offset of the first ch at or after pos, npos if there is none
+    size_t find(char_t ch, offset_t pos = 0) {
+        auto chunk = cursor(pos);
+        while (chunk.next()) {
+            auto *found = std::char_traits<char_t>::find(chunk.c_str(), chunk.length(), ch);
+            if (found) {
+                return chunk.position() - chunk.length() + (found - chunk.c_str());
             }
-            if (iter_start == iter_end) {
-                break;
+        }
+        return string_t::npos;
+    }
+    // Offset of the last ch before pos, npos if there is none
+    size_t rfind(char_t ch, offset_t pos) {
+        auto chunk = cursor(pos);
+        while (chunk.prev()) {
+            for (size_t index = chunk.length(); index > 0; --index) {
+                if (chunk.c_str()[index - 1] == ch) {
+                    return chunk.position() + index - 1;
+                }
             }
         }
+        return string_t::npos;
     }
     string_t line_string(size_t line) {
         string_t string;
@@ -294,54 +468,219 @@ public:
         });
         return string;
     }
+    // Length of the common prefix of the document and str
+    size_t common_prefix(const char_t *str, size_t length) {
+        size_t limit = std::min(size(), length), offset = 0;
+        if (limit == 0) {
+            return 0;
+        }
+        auto chunk = iter(0, limit);
+        while (chunk.next()) {
+            size_t equal = mismatch_forward(chunk.c_str(), str + offset, chunk.length());
+            offset += equal;
+            if (equal < chunk.length()) {
+                break;
+            }
+        }
+        return offset;
+    }
+    // Length of the common suffix of the document and str, at most limit characters
+    size_t common_suffix(const char_t *str, size_t length, size_t limit) {
+        limit = std::min(std::min(size(), length), limit);
+        if (limit == 0) {
+            return 0;
+        }
+        auto chunk = cursor(size(), size() - limit, size());
+        size_t offset = 0;
+        while (chunk.prev()) {
+            size_t equal = mismatch_backward(chunk.c_str() + chunk.length(), str + length - offset, chunk.length());
+            offset += equal;
+            if (equal < chunk.length()) {
+                break;
+            }
+        }
+        return offset;
+    }
     iter_t append_origin(const char_t *map, size_t length) {
-        Piece piece;
-        piece.buffer = m_buffers.size();
-        piece.start = 0;
-        piece.length = length;
-        piece.left_lines = lines();
-        piece.left_length = size();
-
         m_buffers.emplace_back(map, length);
-        auto &back = m_buffers.back();
-
-        piece.buffer_lines = back.lines.size();
-        return std::get<0>(m_pieces.emplace(piece));
+        return append_buffer(length);
+    }
+    // Append an origin whose line index is already known (e.g. from a LineCache)
+    iter_t append_origin(const char_t *map, size_t length, const uint32_t *lines, size_t line_count) {
+        m_buffers.emplace_back(map, length, lines, line_count);
+        return append_buffer(length);
     }
     iter_t insert_origin(offset_t pos, const char_t *map, size_t length) {
-        auto iter = split(pos);
-        Piece pt;
-        pt.buffer = m_buffers.size();
-        pt.start = 0;
-        pt.length = length;
-
+        if (pos >= size()) {
+            return append_origin(map, length);
+        }
         m_buffers.emplace_back(map, length);
-        auto &back = m_buffers.back();
-        pt.buffer_lines = back.lines.size();
-
-        pt.left_length = iter->left_length;
-        pt.left_lines = iter->left_lines;
-        fixup(iter, pt.length, pt.buffer_lines);
-        return m_pieces.insert(iter, pt);
+        return insert_buffer(pos, length);
+    }
+    iter_t insert_origin(offset_t pos, const char_t *map, size_t length, const uint32_t *lines, size_t line_count) {
+        if (pos >= size()) {
+            return append_origin(map, length, lines, line_count);
+        }
+        m_buffers.emplace_back(map, length, lines, line_count);
+        return insert_buffer(pos, length);
+    }
+    inline const Lines &line_index(buffer_idx_t buffer) { return m_buffers[buffer].lines; }
+    // Document lines [start, end) that replaced origin lines [origin_start, origin_end)
+    struct Change {
+        size_t start;
+        size_t end;
+        size_t origin_start;
+        size_t origin_end;
+    };
+    // Line hunks against an origin buffer, derived from the pieces alone.
+    // A line is unchanged when it is copied whole from the origin, every
+    // other line belongs to a hunk; end == start marks deleted origin lines.
+    std::vector<Change> changes(buffer_idx_t origin = Insert + 1) {
+        std::vector<Change> result;
+        if (origin >= m_buffers.size()) {
+            return result;
+        }
+        auto &buffer = m_buffers[origin];
+        size_t next_line = 0, next_origin_line = 0;
+        auto match = [&](size_t line, size_t origin_line, size_t count) {
+            if (line != next_line || origin_line != next_origin_line) {
+                result.push_back({next_line, line, next_origin_line, origin_line});
+            }
+            next_line = line + count;
+            next_origin_line = origin_line + count;
+        };
+        // The character before the current piece is a line feed
+        bool line_start = true;
+        auto iter = m_pieces.begin();
+        while (iter != m_pieces.end()) {
+            if (iter->buffer != origin) {
+                if (iter->length) {
+                    line_start = m_buffers[iter->buffer][iter->start + iter->length - 1] == char_lf;
+                }
+                ++iter;
+                continue;
+            }
+            // Pieces split apart without anything in between are one run of the origin
+            auto first = iter;
+            size_t end = iter->start + iter->length, line_count = iter->buffer_lines;
+            for (++iter; iter != m_pieces.end() && iter->buffer == origin && iter->start == end; ++iter) {
+                end += iter->length;
+                line_count += iter->buffer_lines;
+            }
+            if (end == first->start) {
+                continue;
+            }
+            bool aligned = line_start && (first->start == 0 || buffer[first->start - 1] == char_lf);
+            size_t skip = aligned ? 0 : 1;
+            if (skip < line_count) {
+                match(first->left_lines + skip, first->buffer_line_offset + skip, line_count - skip);
+            }
+            if (iter == m_pieces.end() && end == buffer.map_length && (line_count || aligned)) {
+                match(first->left_lines + line_count, first->buffer_line_offset + line_count, 1);
+            }
+            line_start = buffer[end - 1] == char_lf;
+        }
+        size_t line_count = lines() + 1, origin_line_count = buffer.lines.size() + 1;
+        if (next_line != line_count || next_origin_line != origin_line_count) {
+            result.push_back({next_line, line_count, next_origin_line, origin_line_count});
+        }
+        return result;
+    }
+    // Origin line a document line was copied from, npos if it is modified
+    size_t origin_line(size_t line, buffer_idx_t origin = Insert + 1) {
+        if (m_pieces.empty() || line > lines()) {
+            return string_t::npos;
+        }
+        offset_t start = line_start(line), end = line_end(line);
+        auto iter = upper_pos(start);
+        if (iter->buffer != origin) {
+            return string_t::npos;
+        }
+        auto &buffer = m_buffers[iter->buffer];
+        offset_t buffer_offset = iter->start + start - iter->left_length;
+        if (buffer_offset > 0 && buffer[buffer_offset - 1] != char_lf) {
+            return string_t::npos;
+        }
+        // Follow the pieces still contiguous in the origin up to the line feed
+        for (auto last = iter; end >= last->left_length + last->length;) {
+            auto next = std::next(last);
+            if (next == m_pieces.end()) {
+                // the last line has no line feed and must reach the origin end
+                if (line != lines() || last->start + last->length != buffer.map_length) {
+                    return string_t::npos;
+                }
+                break;
+            }
+            if (next->buffer != origin || next->start != last->start + last->length) {
+                return string_t::npos;
+            }
+            last = next;
+        }
+        return std::lower_bound(buffer.lines.begin(), buffer.lines.end(), buffer_offset) - buffer.lines.begin();
+    }
+    // Document line an origin line ended up at, npos if it was modified or erased
+    size_t current_line(size_t origin_line, buffer_idx_t origin = Insert + 1) {
+        for (auto &change : changes(origin)) {
+            if (origin_line < change.origin_start) {
+                return change.start - (change.origin_start - origin_line);
+            }
+            if (origin_line < change.origin_end) {
+                return string_t::npos;
+            }
+        }
+        size_t line = lines() - (m_buffers[origin].lines.size() - origin_line);
+        return origin_line > m_buffers[origin].lines.size() ? string_t::npos : line;
     }
     void dump(bool print_line = false, bool print_node_string = false) {
         if (print_line) {
             for (int i = 0; i < lines(); ++i) {
-                std::cout << "[" << line_start(i) << ", " << line_end(i) << "] "
-                          << i << ": " << line_string(i) << std::endl;
+                std::cout << "[" << line_start(i) << ", " << line_end(i) << "] " << i << ": ";
+                auto line = line_string(i);
+                print_string(line.data(), line.length());
+                std::cout << std::endl;
             }
         }
         for (auto &ittt : m_pieces) {
             ittt.dump();
             if (print_node_string) {
-                std::string string(&m_buffers[ittt.buffer][ittt.start], ittt.length);
-                std::cout << " value:" << string;
+                std::cout << " value:";
+                print_string(&m_buffers[ittt.buffer][ittt.start], ittt.length);
             }
             std::cout << std::endl;
         }
     }
 private:
+    // Wide code units outside ASCII print as '?', UTF8 bytes pass through
+    static void print_string(const char_t *str, size_t length) {
+        for (size_t i = 0; i < length; ++i) {
+            std::cout << (str[i] < 0x80 ? char(str[i]) : '?');
+        }
+    }
+    iter_t append_buffer(size_t length) {
+        Piece piece;
+        piece.buffer = m_buffers.size() - 1;
+        piece.start = 0;
+        piece.length = length;
+        piece.left_lines = lines();
+        piece.left_length = size();
+        piece.buffer_lines = m_buffers.back().lines.size();
+        return std::get<0>(m_pieces.emplace(piece));
+    }
+    iter_t insert_buffer(offset_t pos, size_t length) {
+        auto iter = split(pos);
+        Piece pt;
+        pt.buffer = m_buffers.size() - 1;
+        pt.start = 0;
+        pt.length = length;
+        pt.buffer_lines = m_buffers.back().lines.size();
+
+        pt.left_length = iter->left_length;
+        pt.left_lines = iter->left_lines;
+        fixup(iter, pt.length, pt.buffer_lines);
+        return m_pieces.insert(iter, pt);
+    }
     iter_t split(offset_t pos) {
+        TRACE_SCOPE("PieceTable::split");
         if (pos >= size()) {
             return m_pieces.end();
         }
@@ -398,6 +737,7 @@ private:
         }*/
     }
     inline void fixup(iter_t iter, int32_t delta_length = 0, int32_t delta_lines = 0) {
+        TRACE_SCOPE("PieceTable::fixup");
         for (auto end = m_pieces.end(); iter != end; iter++) {
             iter->left_length += delta_length;
             iter->left_lines += delta_lines;
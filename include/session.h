@@ -0,0 +1,375 @@
+﻿//
+// Created by Alex on 2020/5/9.
+//
+
+#ifndef GEDITOR_SESSION_H
+#define GEDITOR_SESSION_H
+#include <piece_table.h>
+#include <origin.h>
+#include <cstdio>
+#include <cstring>
+#if WIN32
+#include <io.h>
+#endif
+// Hot-exit session file:
+//   Header | Origin* (path, identity, line index) | Edit buffers | Pieces | Record*
+// The snapshot part is written once by save(), edits are appended as records.
+// restore() maps the file, checks the origins and rebuilds the table from the
+// piece list, the origin line indexes are used in place from the mapping.
+template <class char_t = char, class string_t = std::basic_string<char_t>>
+class Session {
+    using table_t = PieceTable<char_t, string_t>;
+    using piece_t = typename table_t::Piece;
+    using offset_t = typename table_t::offset_t;
+    constexpr static uint32_t session_magic = 0x53545341; // ASTS
+    constexpr static uint32_t session_version = 1;
+    enum {
+        RecordInsert = 1,
+        RecordErase = 2
+    };
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t char_size;
+        uint32_t origin_count;
+        uint32_t piece_count;
+        uint32_t reserved;
+        uint64_t snapshot_size;
+    };
+    struct OriginHeader {
+        uint64_t size;
+        int64_t mtime;
+        uint64_t hash;
+        uint32_t path_length;
+        uint32_t line_count;
+    };
+    struct BufferHeader {
+        uint32_t length;
+        uint32_t line_count;
+    };
+    struct PieceRecord {
+        uint32_t buffer;
+        uint32_t buffer_lines;
+        uint32_t buffer_line_offset;
+        uint32_t start;
+        uint32_t length;
+        uint32_t left_lines;
+        uint32_t left_length;
+        uint32_t reserved;
+    };
+    struct Record {
+        uint32_t type;
+        uint32_t start;
+        // inserted characters for RecordInsert, end offset for RecordErase
+        uint32_t value;
+        uint32_t reserved;
+    };
+    std::string m_path;
+    // Mapping of the session file, keeps the origin line indexes alive
+    std::unique_ptr<Origin> m_mapping;
+    std::vector<std::unique_ptr<Origin>> m_origins;
+    FILE *m_journal = nullptr;
+    size_t m_pending = 0;
+    size_t m_sync_threshold = 64 * 1024;
+public:
+    Session(const std::string &path) : m_path(path) {}
+    Session(const Session &rhs) = delete;
+    ~Session() {
+        close();
+    }
+    inline const std::string &path() { return m_path; }
+    inline void set_sync_threshold(size_t bytes) { m_sync_threshold = bytes; }
+    // Origins mapped by restore(), must outlive the restored table
+    inline Origin &origin(size_t index) { return *m_origins[index]; }
+    inline size_t origin_count() { return m_origins.size(); }
+    // Write a full snapshot of the table, origin_paths[i] is the file behind buffer i + 2
+    bool save(table_t &table, const std::vector<std::string> &origin_paths) {
+        if (origin_paths.size() + 2 != table.m_buffers.size()) {
+            return false;
+        }
+        close();
+        std::string temp = m_path + ".tmp";
+        FILE *file = fopen(temp.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        uint64_t offset = 0;
+        auto write = [&](const void *data, size_t size) {
+            if (size) {
+                fwrite(data, 1, size, file);
+            }
+            offset += size;
+        };
+        auto align = [&]() {
+            static const char zeros[8] = {0};
+            write(zeros, (8 - offset % 8) % 8);
+        };
+        Header header = {session_magic, session_version, sizeof(char_t),
+                         (uint32_t) origin_paths.size(), (uint32_t) table.m_pieces.size(), 0, 0};
+        write(&header, sizeof(header));
+        for (size_t i = 0; i < origin_paths.size(); ++i) {
+            auto &buffer = table.m_buffers[i + 2];
+            Origin origin(origin_paths[i].c_str());
+            OriginHeader origin_header = {origin.size(), origin.mtime(), origin.hash(),
+                                          (uint32_t) origin_paths[i].length(), (uint32_t) buffer.lines.size()};
+            write(&origin_header, sizeof(origin_header));
+            write(origin_paths[i].data(), origin_paths[i].length());
+            align();
+            write(buffer.lines.begin(), buffer.lines.size() * sizeof(uint32_t));
+            align();
+        }
+        for (int i = table_t::Append; i <= table_t::Insert; ++i) {
+            auto &buffer = table.m_buffers[i];
+            BufferHeader buffer_header = {(uint32_t) buffer.size(), (uint32_t) buffer.lines.size()};
+            write(&buffer_header, sizeof(buffer_header));
+            write(buffer.buffer->data(), buffer.size() * sizeof(char_t));
+            align();
+            write(buffer.lines.begin(), buffer.lines.size() * sizeof(uint32_t));
+            align();
+        }
+        for (auto &piece : table.m_pieces) {
+            PieceRecord record = {piece.buffer, piece.buffer_lines, piece.buffer_line_offset,
+                                  piece.start, piece.length, piece.left_lines, piece.left_length, 0};
+            write(&record, sizeof(record));
+        }
+        header.snapshot_size = offset;
+        fseek(file, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, file);
+        bool success = !ferror(file);
+        fflush(file);
+        flush_file(file);
+        fclose(file);
+        if (!success || !replace_file(temp, m_path)) {
+            remove(temp.c_str());
+            return false;
+        }
+        m_journal = fopen(m_path.c_str(), "ab");
+        return m_journal != nullptr;
+    }
+    // Rebuild the table from the session file, false if it is missing,
+    // corrupt or one of its origins changed on disk
+    bool restore(table_t &table) {
+        close();
+        auto mapping = std::make_unique<Origin>(m_path.c_str());
+        auto *base = (const char *) mapping->ptr();
+        size_t size = mapping->size();
+        if (!base || size < sizeof(Header)) {
+            return false;
+        }
+        Header header;
+        memcpy(&header, base, sizeof(header));
+        if (header.magic != session_magic || header.version != session_version ||
+            header.char_size != sizeof(char_t) || header.snapshot_size > size) {
+            return false;
+        }
+        size_t offset = sizeof(header);
+        bool valid = true;
+        auto read = [&](size_t length) -> const char * {
+            if (!valid || offset + length > header.snapshot_size) {
+                valid = false;
+                return nullptr;
+            }
+            const char *ptr = base + offset;
+            offset += length;
+            return ptr;
+        };
+        auto align = [&]() {
+            offset += (8 - offset % 8) % 8;
+        };
+        std::vector<std::unique_ptr<Origin>> origins;
+        std::vector<typename table_t::Buffer> buffers(2);
+        for (uint32_t i = 0; i < header.origin_count; ++i) {
+            OriginHeader origin_header;
+            auto *ptr = read(sizeof(origin_header));
+            if (!ptr) {
+                return false;
+            }
+            memcpy(&origin_header, ptr, sizeof(origin_header));
+            auto *path = read(origin_header.path_length);
+            align();
+            auto *lines = read(origin_header.line_count * sizeof(uint32_t));
+            align();
+            if (!valid) {
+                return false;
+            }
+            auto origin = std::make_unique<Origin>(std::string(path, origin_header.path_length).c_str());
+            if (origin->size() != origin_header.size || origin->mtime() != origin_header.mtime ||
+                origin->hash() != origin_header.hash) {
+                return false;
+            }
+            buffers.emplace_back((const char_t *) origin->ptr(), origin->size() / sizeof(char_t),
+                                 (const uint32_t *) lines, origin_header.line_count);
+            origins.push_back(std::move(origin));
+        }
+        for (int i = table_t::Append; i <= table_t::Insert; ++i) {
+            BufferHeader buffer_header;
+            auto *ptr = read(sizeof(buffer_header));
+            if (!ptr) {
+                return false;
+            }
+            memcpy(&buffer_header, ptr, sizeof(buffer_header));
+            auto *data = read(buffer_header.length * sizeof(char_t));
+            align();
+            auto *lines = read(buffer_header.line_count * sizeof(uint32_t));
+            align();
+            if (!valid) {
+                return false;
+            }
+            auto &buffer = buffers[i];
+            buffer.buffer->assign((const char_t *) data, buffer_header.length);
+            buffer.lines.owned.assign((const uint32_t *) lines, (const uint32_t *) lines + buffer_header.line_count);
+        }
+        auto *pieces = (const PieceRecord *) read(header.piece_count * sizeof(PieceRecord));
+        if (!pieces) {
+            return false;
+        }
+        // Each piece stays inside its buffer and follows the one before it
+        uint64_t table_length = 0, table_lines = 0;
+        for (uint32_t i = 0; i < header.piece_count; ++i) {
+            auto &record = pieces[i];
+            if (record.buffer >= buffers.size() ||
+                (uint64_t) record.start + record.length > buffers[record.buffer].size() ||
+                (uint64_t) record.buffer_line_offset + record.buffer_lines > buffers[record.buffer].lines.size() ||
+                record.left_length != table_length || record.left_lines != table_lines) {
+                return false;
+            }
+            table_length += record.length;
+            table_lines += record.buffer_lines;
+        }
+        if (table_length > UINT32_MAX) {
+            return false;
+        }
+        // Check the journal against the table length before replaying it, so a
+        // refused restore leaves the table as it was. A torn record at the tail
+        // is dropped, a record out of the table's bounds refuses the restore.
+        size_t journal_end = header.snapshot_size;
+        while (journal_end + sizeof(Record) <= size) {
+            Record record;
+            memcpy(&record, base + journal_end, sizeof(record));
+            if (record.type == RecordInsert) {
+                size_t length = record.value * sizeof(char_t);
+                if (journal_end + sizeof(Record) + length > size) {
+                    break;
+                }
+                if (record.start > table_length || table_length + record.value > UINT32_MAX) {
+                    return false;
+                }
+                table_length += record.value;
+                journal_end += sizeof(Record) + length;
+                journal_end += (8 - journal_end % 8) % 8;
+            } else if (record.type == RecordErase) {
+                if (record.start > record.value || record.value > table_length) {
+                    return false;
+                }
+                table_length -= record.value - record.start;
+                journal_end += sizeof(Record);
+            } else {
+                break;
+            }
+        }
+        table.m_pieces.clear();
+        table.m_buffers = std::move(buffers);
+        for (uint32_t i = 0; i < header.piece_count; ++i) {
+            piece_t piece;
+            piece.buffer = pieces[i].buffer;
+            piece.buffer_lines = pieces[i].buffer_lines;
+            piece.buffer_line_offset = pieces[i].buffer_line_offset;
+            piece.start = pieces[i].start;
+            piece.length = pieces[i].length;
+            piece.left_lines = pieces[i].left_lines;
+            piece.left_length = pieces[i].left_length;
+            table.m_pieces.emplace_hint(table.m_pieces.end(), piece);
+        }
+        offset = header.snapshot_size;
+        while (offset < journal_end) {
+            Record record;
+            memcpy(&record, base + offset, sizeof(record));
+            if (record.type == RecordInsert) {
+                auto *data = (const char_t *) (base + offset + sizeof(Record));
+                table.insert(record.start, string_t(data, record.value));
+                offset += sizeof(Record) + record.value * sizeof(char_t);
+                offset += (8 - offset % 8) % 8;
+            } else {
+                table.erase(record.start, record.value);
+                offset += sizeof(Record);
+            }
+        }
+        m_origins = std::move(origins);
+        m_mapping = std::move(mapping);
+        m_journal = fopen(m_path.c_str(), "r+b");
+        if (!m_journal) {
+            return false;
+        }
+        if (offset < size) {
+            truncate_file(m_journal, offset);
+        }
+        fseek(m_journal, 0, SEEK_END);
+        return true;
+    }
+    void record_insert(offset_t pos, const string_t &string) {
+        Record record = {RecordInsert, pos, (uint32_t) string.length(), 0};
+        size_t length = string.length() * sizeof(char_t);
+        static const char zeros[8] = {0};
+        append(&record, sizeof(record));
+        append(string.data(), length);
+        append(zeros, (8 - length % 8) % 8);
+    }
+    void record_erase(offset_t start, offset_t end) {
+        Record record = {RecordErase, start, end, 0};
+        append(&record, sizeof(record));
+    }
+    // Flush pending records to disk, called automatically every sync_threshold bytes
+    void sync() {
+        if (!m_journal || !m_pending) {
+            return;
+        }
+        fflush(m_journal);
+        flush_file(m_journal);
+        m_pending = 0;
+    }
+    void close() {
+        if (m_journal) {
+            sync();
+            fclose(m_journal);
+            m_journal = nullptr;
+        }
+    }
+private:
+    inline void append(const void *data, size_t size) {
+        if (!m_journal || !size) {
+            return;
+        }
+        fwrite(data, 1, size, m_journal);
+        m_pending += size;
+        if (m_pending >= m_sync_threshold) {
+            sync();
+        }
+    }
+    static void flush_file(FILE *file) {
+#if WIN32
+        _commit(_fileno(file));
+#else
+        fsync(fileno(file));
+#endif
+    }
+    static void truncate_file(FILE *file, size_t size) {
+        fflush(file);
+#if WIN32
+        _chsize_s(_fileno(file), size);
+#else
+        if (ftruncate(fileno(file), size) != 0) {
+            return;
+        }
+#endif
+    }
+    static bool replace_file(const std::string &from, const std::string &to) {
+#if WIN32
+        return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        // rename keeps an existing mapping of the old file valid
+        return rename(from.c_str(), to.c_str()) == 0;
+#endif
+    }
+};
+
+#endif //GEDITOR_SESSION_H
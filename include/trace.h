@@ -0,0 +1,28 @@
+﻿//
+// Created by Alex on 2020/5/11.
+//
+
+#ifndef GEDITOR_TRACE_H
+#define GEDITOR_TRACE_H
+// Spans compile in only with TREE_SITTER_TRACE, build the runtime with it too
+#ifdef TREE_SITTER_TRACE
+#include <tree_sitter/api.h>
+class TraceScope {
+    const char *m_name;
+    uint64_t m_start;
+public:
+    explicit TraceScope(const char *name) : m_name(name), m_start(ts_trace_now()) {}
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+    ~TraceScope() {
+        ts_trace_record("editor", m_name, m_start, ts_trace_now());
+    }
+};
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
+#endif //GEDITOR_TRACE_H
@@ -6,7 +6,14 @@
 #define GEDITOR_TREE_SITTER_H
 #include <tree_sitter/api.h>
 #include <string>
+#include <vector>
 #include <functional>
+#include <mutex>
+#include <atomic>
+#include <regex>
+#include <map>
+#include <unordered_map>
+#include <memory>
 extern "C" TSLanguage *tree_sitter_cpp();
 namespace ts {
     using string_view = std::string;
@@ -44,25 +51,122 @@ namespace ts {
         inline Iterator begin() { return m_predicate; }
         inline Iterator end() { return m_predicate + m_length; }
     };
+    // Query cursors kept for reuse between threads. A cursor keeps the arrays it
+    // grew when it goes back to the pool, so a repeated pass doesn't allocate.
+    class CursorPool {
+        std::mutex m_mutex;
+        std::vector<TSQueryCursor *> m_cursors;
+        std::atomic<uint64_t> m_created{0};
+        std::atomic<uint64_t> m_acquired{0};
+    public:
+        CursorPool() = default;
+        CursorPool(const CursorPool &rhs) = delete;
+        ~CursorPool() {
+            for (auto *cursor : m_cursors) {
+                ts_query_cursor_delete(cursor);
+            }
+        }
+        TSQueryCursor *acquire() {
+            m_acquired++;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_cursors.empty()) {
+                    TSQueryCursor *cursor = m_cursors.back();
+                    m_cursors.pop_back();
+                    return cursor;
+                }
+            }
+            m_created++;
+            return ts_query_cursor_new();
+        }
+        void release(TSQueryCursor *cursor) {
+            ts_query_cursor_set_byte_range(cursor, 0, UINT32_MAX);
+            ts_query_cursor_set_point_range(cursor, {0, 0}, {UINT32_MAX, UINT32_MAX});
+            ts_query_cursor_set_match_limit(cursor, UINT32_MAX);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cursors.push_back(cursor);
+        }
+        // Cursors allocated so far, it stops growing once the pool is warm
+        inline uint64_t created() const { return m_created; }
+        inline uint64_t acquired() const { return m_acquired; }
+        // The pool of Query::exec
+        static CursorPool &global() {
+            static CursorPool pool;
+            return pool;
+        }
+    };
+    // Text of a contiguous document for the query predicates, in the byte
+    // offsets of the nodes. ASTBuffer offers the same over its piece table.
+    class StringText {
+        const char *m_data;
+    public:
+        StringText(const std::string &text) : m_data(text.data()) {}
+        StringText(const char *data) : m_data(data) {}
+        bool equal(uint32_t start, uint32_t end, const char *str, size_t length) {
+            return end - start == length && std::char_traits<char>::compare(m_data + start, str, length) == 0;
+        }
+        bool equal(uint32_t start, uint32_t end, uint32_t other_start, uint32_t other_end) {
+            return equal(start, end, m_data + other_start, other_end - other_start);
+        }
+        bool search(uint32_t start, uint32_t end, const std::regex &regex) {
+            return std::regex_search(m_data + start, m_data + end, regex);
+        }
+    };
+    class QueryRegistry;
     class Query {
+        friend class QueryRegistry;
         TSQuery *m_query = nullptr;
-        uint32_t m_offset;
-        TSQueryError m_error;
+        uint32_t m_offset = 0;
+        TSQueryError m_error = TSQueryErrorNone;
+    public:
+        // A built in predicate of a pattern, compiled with the query
+        struct Predicate {
+            enum Type { Eq, NotEq, Match, NotMatch };
+            Type type;
+            uint32_t capture_id;
+            // eq? compares with this capture, or with value when there is none
+            uint32_t other_capture_id = UINT32_MAX;
+            std::string value;
+            std::regex regex;
+            Predicate(Type type, uint32_t capture_id) : type(type), capture_id(capture_id) {}
+        };
+        // The language of an `inject` predicate, for the text of its capture
+        struct Injection {
+            uint32_t capture_id = UINT32_MAX;
+            std::string language;
+            inline bool empty() const { return capture_id == UINT32_MAX; }
+        };
+    private:
+        std::vector<std::vector<Predicate>> m_predicates;
+        std::vector<Injection> m_injections;
     public:
         class Cursor {
             friend class Query;
             TSQueryCursor *m_cursor = nullptr;
+            CursorPool *m_pool = nullptr;
+            const Query *m_query = nullptr;
             TSQueryMatch m_match;
+            // The last match that passed the predicates, its other captures skip them
+            uint32_t m_passed_id = UINT32_MAX;
         public:
             Cursor() : m_cursor(ts_query_cursor_new()) {}
+            // Checked out of the pool and given back on destruction
+            Cursor(CursorPool &pool) : m_cursor(pool.acquire()), m_pool(&pool) {}
             Cursor(const Cursor &rhs) = delete;
             Cursor(Cursor &&rhs) {
                 m_cursor = rhs.m_cursor;
+                m_pool = rhs.m_pool;
+                m_query = rhs.m_query;
+                m_passed_id = rhs.m_passed_id;
                 rhs.m_cursor = nullptr;
             }
             ~Cursor() {
                 if (m_cursor) {
-                    ts_query_cursor_delete(m_cursor);
+                    if (m_pool) {
+                        m_pool->release(m_cursor);
+                    } else {
+                        ts_query_cursor_delete(m_cursor);
+                    }
                 }
             }
             bool next_capture(uint32_t &index) {
@@ -71,12 +175,45 @@ namespace ts {
             bool next_match() {
                 return ts_query_cursor_next_match(m_cursor, &m_match);
             }
+            // Like next_capture, the matches failing the built in predicates of their
+            // pattern are removed first. Text is a StringText or an ASTBuffer.
+            template <class Text>
+            bool next_capture(uint32_t &index, Text &text) {
+                while (next_capture(index)) {
+                    if (m_match.id == m_passed_id || m_query->satisfies(m_match, text)) {
+                        m_passed_id = m_match.id;
+                        return true;
+                    }
+                    ts_query_cursor_remove_match(m_cursor, m_match.id);
+                }
+                return false;
+            }
+            template <class Text>
+            bool next_match(Text &text) {
+                while (next_match()) {
+                    if (m_query->satisfies(m_match, text)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
             void set_byte_range(uint32_t start, uint32_t end) {
                 ts_query_cursor_set_byte_range(m_cursor, start, end);
             }
             void set_point_range(TSPoint start, TSPoint end) {
                 ts_query_cursor_set_point_range(m_cursor, start, end);
             }
+            // Matches kept in progress at once, from the next exec
+            void set_match_limit(uint32_t limit) {
+                ts_query_cursor_set_match_limit(m_cursor, limit);
+            }
+            uint32_t match_limit() {
+                return ts_query_cursor_match_limit(m_cursor);
+            }
+            // Matches dropped to the match limit since exec
+            uint32_t overflow_count() {
+                return ts_query_cursor_overflow_count(m_cursor);
+            }
             inline TSQueryMatch &match() {
                 return m_match;
             }
@@ -98,14 +235,16 @@ namespace ts {
             }
             inline uint16_t pattern_index() { return m_match.pattern_index; };
         };
-        Query(TSLanguage *language, const string_view &query) {
-            m_query = ts_query_new(language, query.data(), query.length(), &m_offset, &m_error);
-        }
+        // Compiled once per source by the registry, later ones are copies
+        inline Query(TSLanguage *language, const string_view &query);
+        inline Query(TSLanguage *language, const string_view &query, QueryRegistry &registry);
         Query(const Query &rhs) = delete;
         Query(Query &&rhs) {
             m_query = rhs.m_query;
             m_offset = rhs.m_offset;
             m_error = rhs.m_error;
+            m_predicates = std::move(rhs.m_predicates);
+            m_injections = std::move(rhs.m_injections);
             rhs.m_query = nullptr;
         }
         ~Query() {
@@ -141,10 +280,266 @@ namespace ts {
         PredicateStep pattern_predicates(uint32_t pattern_index) {
             return {m_query, pattern_index};
         }
+        // eq?, not-eq?, match? and not-match? of the pattern, the cursor checks them
+        const std::vector<Predicate> &predicates(uint32_t pattern_index) const {
+            return m_predicates[pattern_index];
+        }
+        const Injection &injection(uint32_t pattern_index) const {
+            return m_injections[pattern_index];
+        }
+        // Whether the captures of the match pass the built in predicates
+        template <class Text>
+        bool satisfies(const TSQueryMatch &match, Text &text) const {
+            for (auto &predicate : m_predicates[match.pattern_index]) {
+                const TSNode *node = find_capture(match, predicate.capture_id);
+                if (!node) {
+                    continue;
+                }
+                uint32_t start = ts_node_start_byte(*node), end = ts_node_end_byte(*node);
+                bool result;
+                if (predicate.type == Predicate::Eq || predicate.type == Predicate::NotEq) {
+                    if (predicate.other_capture_id != UINT32_MAX) {
+                        const TSNode *other = find_capture(match, predicate.other_capture_id);
+                        if (!other) {
+                            continue;
+                        }
+                        result = text.equal(start, end, ts_node_start_byte(*other), ts_node_end_byte(*other));
+                    } else {
+                        result = text.equal(start, end, predicate.value.data(), predicate.value.length());
+                    }
+                    result = result == (predicate.type == Predicate::Eq);
+                } else {
+                    result = text.search(start, end, predicate.regex) == (predicate.type == Predicate::Match);
+                }
+                if (!result) {
+                    return false;
+                }
+            }
+            return true;
+        }
         uint32_t pattern_start_byte(uint32_t pattern_index) {
             return ts_query_start_byte_for_pattern(m_query, pattern_index);
         }
-        Cursor inline exec(const Node &node);
+        // UINT32_MAX when no node of the query matches the symbol
+        uint32_t max_depth(TSSymbol symbol) {
+            return ts_query_max_depth_for_symbol(m_query, symbol);
+        }
+        // Runs on a cursor of the pool, by default the global one
+        Cursor inline exec(const Node &node, CursorPool &pool = CursorPool::global());
+        // Runs again on a cursor the caller keeps
+        void inline exec(Cursor &cursor, const Node &node);
+    private:
+        static const TSNode *find_capture(const TSQueryMatch &match, uint32_t capture_id) {
+            for (uint16_t i = 0; i < match.capture_count; ++i) {
+                if (match.captures[i].index == capture_id) {
+                    return &match.captures[i].node;
+                }
+            }
+            return nullptr;
+        }
+        Query() = default;
+        void assign(const Query &rhs) {
+            m_query = rhs.m_query ? ts_query_copy(rhs.m_query) : nullptr;
+            m_offset = rhs.m_offset;
+            m_error = rhs.m_error;
+            m_predicates = rhs.m_predicates;
+            m_injections = rhs.m_injections;
+        }
+        // Predicates of other names or shapes are left to the caller. A bad regex
+        // is reported like a syntax error at the start of its pattern.
+        void compile_predicates() {
+            uint32_t count = pattern_count();
+            // Patterns often share a regex, it's compiled once for all of them
+            std::map<string_view, std::regex> regexes;
+            m_predicates.resize(count);
+            m_injections.resize(count);
+            for (uint32_t pattern = 0; pattern < count; ++pattern) {
+                uint32_t length;
+                auto *steps = ts_query_predicates_for_pattern(m_query, pattern, &length);
+                for (uint32_t start = 0, end; start < length; start = end + 1) {
+                    for (end = start; steps[end].type != TSQueryPredicateStepTypeDone; ++end) {}
+                    if (end - start != 3 ||
+                        steps[start].type != TSQueryPredicateStepTypeString ||
+                        steps[start + 1].type != TSQueryPredicateStepTypeCapture) {
+                        continue;
+                    }
+                    string_view name = string_value(steps[start].value_id);
+                    uint32_t capture_id = steps[start + 1].value_id;
+                    bool is_capture = steps[start + 2].type == TSQueryPredicateStepTypeCapture;
+                    string_view value = is_capture ? string_view() : string_value(steps[start + 2].value_id);
+                    if (name == "eq?" || name == "not-eq?") {
+                        Predicate predicate(name == "eq?" ? Predicate::Eq : Predicate::NotEq, capture_id);
+                        if (is_capture) {
+                            predicate.other_capture_id = steps[start + 2].value_id;
+                        } else {
+                            predicate.value = value;
+                        }
+                        m_predicates[pattern].push_back(std::move(predicate));
+                    } else if ((name == "match?" || name == "not-match?") && !is_capture) {
+                        Predicate predicate(name == "match?" ? Predicate::Match : Predicate::NotMatch, capture_id);
+                        auto iter = regexes.find(value);
+                        if (iter != regexes.end()) {
+                            predicate.regex = iter->second;
+                        } else {
+                            try {
+                                predicate.regex.assign(value);
+                            } catch (const std::regex_error &) {
+                                m_error = TSQueryErrorSyntax;
+                                m_offset = pattern_start_byte(pattern);
+                                continue;
+                            }
+                            regexes.emplace(value, predicate.regex);
+                        }
+                        m_predicates[pattern].push_back(std::move(predicate));
+                    } else if ((name == "inject" || name == "inject!") && !is_capture) {
+                        m_injections[pattern] = {capture_id, value};
+                    }
+                }
+            }
+        }
+    };
+    // Compiled queries of the process, by language and source. A source is parsed
+    // on its first request and later requests copy the compiled query, so each
+    // copy can still disable its own patterns. The compiled queries can be saved
+    // to load at the next startup, a saved one that no longer fits the language
+    // or the library is dropped and its source compiled again.
+    class QueryRegistry {
+        struct Entry {
+            std::unique_ptr<Query> query;
+            // Loaded by load, read on the first request
+            std::string blob;
+        };
+        static constexpr uint32_t Magic = 0x52515354;
+        std::mutex m_mutex;
+        std::map<const TSLanguage *, std::unordered_map<std::string, Entry>> m_entries;
+        std::atomic<uint64_t> m_compiled{0};
+        std::atomic<uint64_t> m_requested{0};
+        template <class T>
+        static void write(std::string &data, T value) {
+            data.append((const char *) &value, sizeof(T));
+        }
+        template <class T>
+        static bool read(const std::string &data, size_t &pos, T &value) {
+            if (data.size() - pos < sizeof(T)) {
+                return false;
+            }
+            std::char_traits<char>::copy((char *) &value, data.data() + pos, sizeof(T));
+            pos += sizeof(T);
+            return true;
+        }
+        static bool read(const std::string &data, size_t &pos, std::string &value) {
+            uint32_t length;
+            if (!read(data, pos, length) || data.size() - pos < length) {
+                return false;
+            }
+            value.assign(data, pos, length);
+            pos += length;
+            return true;
+        }
+    public:
+        QueryRegistry() = default;
+        QueryRegistry(const QueryRegistry &rhs) = delete;
+        // Makes the query a copy of the source's, or its error when it doesn't compile
+        void create(Query &query, const TSLanguage *language, const string_view &source) {
+            m_requested++;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto &entries = m_entries[language];
+                auto iter = entries.find(source);
+                if (iter != entries.end()) {
+                    auto &entry = iter->second;
+                    if (!entry.query) {
+                        TSQuery *loaded = ts_query_deserialize(language, entry.blob.data(), entry.blob.size());
+                        if (loaded) {
+                            entry.query.reset(new Query());
+                            entry.query->m_query = loaded;
+                            entry.query->compile_predicates();
+                        }
+                        entry.blob = std::string();
+                    }
+                    if (entry.query) {
+                        query.assign(*entry.query);
+                        return;
+                    }
+                    entries.erase(iter);
+                }
+            }
+            m_compiled++;
+            std::unique_ptr<Query> compiled(new Query());
+            compiled->m_query = ts_query_new(language, source.data(), source.length(),
+                                             &compiled->m_offset, &compiled->m_error);
+            if (compiled->m_query) {
+                compiled->compile_predicates();
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &entry = m_entries[language][source];
+            if (!entry.query) {
+                entry.query = std::move(compiled);
+            }
+            query.assign(*entry.query);
+        }
+        // The compiled queries of the language, to load at the next startup
+        std::string save(const TSLanguage *language) {
+            std::string data;
+            write(data, Magic);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto &pair : m_entries[language]) {
+                auto &entry = pair.second;
+                if (entry.query && !entry.query->m_query) {
+                    continue;
+                }
+                write(data, (uint32_t) pair.first.size());
+                data.append(pair.first);
+                if (entry.query) {
+                    uint32_t length = 0;
+                    void *blob = ts_query_serialize(entry.query->m_query, &length);
+                    write(data, length);
+                    data.append((const char *) blob, length);
+                    ts_allocation_free(blob);
+                } else {
+                    write(data, (uint32_t) entry.blob.size());
+                    data.append(entry.blob);
+                }
+            }
+            return data;
+        }
+        // Nothing is read until a source is requested, false when the data isn't
+        // from save. The sources already here keep their queries.
+        bool load(const TSLanguage *language, const std::string &data) {
+            uint32_t magic = 0;
+            size_t pos = 0;
+            if (!read(data, pos, magic) || magic != Magic) {
+                return false;
+            }
+            std::vector<std::pair<std::string, std::string>> loaded;
+            while (pos < data.size()) {
+                std::string source, blob;
+                if (!read(data, pos, source) || !read(data, pos, blob)) {
+                    return false;
+                }
+                loaded.emplace_back(std::move(source), std::move(blob));
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &entries = m_entries[language];
+            for (auto &pair : loaded) {
+                Entry entry;
+                entry.blob = std::move(pair.second);
+                entries.emplace(std::move(pair.first), std::move(entry));
+            }
+            return true;
+        }
+        void clear() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_entries.clear();
+        }
+        // Sources parsed so far, against the queries created from the registry
+        inline uint64_t compiled() const { return m_compiled; }
+        inline uint64_t requested() const { return m_requested; }
+        // The registry of Language::query and the Query constructor
+        static QueryRegistry &global() {
+            static QueryRegistry registry;
+            return registry;
+        }
     };
     class Language {
         const TSLanguage *m_language = nullptr;
@@ -174,6 +569,14 @@ namespace ts {
             return tree_sitter_cpp();
         };
     };
+    // A field name looked up once, to index nodes by it in a loop
+    class Field {
+        TSFieldId m_id = 0;
+    public:
+        constexpr Field(TSFieldId id) : m_id(id) {}
+        Field(Language language, const std::string &name) : m_id(language.field_id(name.data(), name.length())) {}
+        inline operator TSFieldId() const { return m_id; }
+    };
     class Logger {
     public:
         virtual void report(TSLogType type, const char *) = 0;
@@ -182,6 +585,47 @@ namespace ts {
             logger->report(type, str);
         }
     };
+    // Process-wide allocator, install it before any parser, tree or query exists
+    class Allocator {
+    public:
+        virtual void *allocate(size_t size) = 0;
+        virtual void *reallocate(void *ptr, size_t size) = 0;
+        virtual void deallocate(void *ptr) = 0;
+        static void install(Allocator *allocator) {
+            if (!allocator) {
+                ts_set_allocator(nullptr);
+                return;
+            }
+            TSAllocator table = {allocator, Malloc, nullptr, Realloc, Free, nullptr};
+            ts_set_allocator(&table);
+        }
+        static void enable_stats(bool enabled) { ts_set_allocation_stats_enabled(enabled); }
+        static TSAllocationStats stats(TSAllocationSubsystem subsystem) { return ts_allocation_stats(subsystem); }
+        static void reset_stats() { ts_allocation_stats_reset(); }
+    private:
+        static void *Malloc(void *payload, size_t size) {
+            return ((Allocator *) payload)->allocate(size);
+        }
+        static void *Realloc(void *payload, void *ptr, size_t size) {
+            return ((Allocator *) payload)->reallocate(ptr, size);
+        }
+        static void Free(void *payload, void *ptr) {
+            ((Allocator *) payload)->deallocate(ptr);
+        }
+    };
+    // Spans recorded by a runtime built with TREE_SITTER_TRACE, see trace.h
+    class Trace {
+    public:
+        static void clear() { ts_trace_clear(); }
+        static bool dump(const char *path) {
+            FILE *file = fopen(path, "w");
+            if (!file) {
+                return false;
+            }
+            ts_trace_write_chrome_json(file);
+            return fclose(file) == 0;
+        }
+    };
     class Parser {
         TSParser *m_parser = nullptr;
     public:
@@ -214,6 +658,20 @@ namespace ts {
         void set_timeout(uint64_t micros) {
             ts_parser_set_timeout_micros(m_parser, micros);
         }
+        void set_limits(const TSParserLimits &limits) {
+            ts_parser_set_limits(m_parser, &limits);
+        }
+        TSParserLimits limits() {
+            return ts_parser_limits(m_parser);
+        }
+        // Counters and phase timings of the last parse
+        TSParseStats stats() {
+            return ts_parser_stats(m_parser);
+        }
+        // Drop the cached tokens, the next parse lexes from scratch
+        void reset() {
+            ts_parser_reset(m_parser);
+        }
         const size_t *get_cancel_position() {
             return ts_parser_cancellation_flag(m_parser);
         }
@@ -224,10 +682,12 @@ namespace ts {
             return (Logger *) ts_parser_logger(m_parser).payload;
         }
     };
+    class Children;
     class Node {
         TSNode m_node;
         friend class Cursor;
         friend class Query;
+        friend class Children;
     public:
         Node(const TSNode &mNode) : m_node(mNode) {}
         bool empty() const { return ts_node_is_null(m_node); }
@@ -235,12 +695,13 @@ namespace ts {
         bool has_changes() const { return ts_node_has_changes(m_node); }
         bool is_extra() const { return ts_node_is_extra(m_node); }
         bool is_missing() const { return ts_node_is_missing(m_node); }
+        bool has_error() const { return ts_node_has_error(m_node); }
         bool is_named() const { return ts_node_is_named(m_node); }
         uint32_t count() const { return ts_node_child_count(m_node); }
         std::string string() {
             auto *ptr = ts_node_string(m_node);
             std::string _string(ptr);
-            ::free(ptr);
+            ts_allocation_free(ptr);
             return _string;
         }
         const char *type() { return ts_node_type(m_node); }
@@ -249,6 +710,9 @@ namespace ts {
         uint32_t length() const { return end_byte() - start_byte(); }
         TSPoint start_point() const { return ts_node_start_point(m_node); }
         TSPoint end_point() const { return ts_node_end_point(m_node); }
+        Node descendant_for_byte_range(uint32_t start, uint32_t end) const {
+            return ts_node_descendant_for_byte_range(m_node, start, end);
+        }
         Node named_descendant_for_byte_range(uint32_t start, uint32_t end) const {
             return ts_node_named_descendant_for_byte_range(m_node, start, end);
         }
@@ -269,6 +733,19 @@ namespace ts {
         Node operator[](const std::string &index) {
             return ts_node_child_by_field_name(m_node, index.c_str(), index.length());
         }
+        Node operator[](const Field &field) { return ts_node_child_by_field_id(m_node, field); }
+        // Every child in one pass, operator[] walks the hidden nodes again per index
+        inline Children children() const;
+        // Descendants with the symbol, the subtrees that can't hold it are skipped
+        std::vector<Node> descendants(TSSymbol symbol) const {
+            std::vector<TSNode> nodes(16);
+            uint32_t count = ts_node_descendants_for_symbol(m_node, symbol, nodes.data(), nodes.size());
+            if (count > nodes.size()) {
+                nodes.resize(count);
+                ts_node_descendants_for_symbol(m_node, symbol, nodes.data(), count);
+            }
+            return std::vector<Node>(nodes.begin(), nodes.begin() + count);
+        }
         Node &operator++() { m_node = ts_node_next_sibling(m_node); return *this; }
         Node operator++(int) { return next(); }
         inline Node begin() { return ts_node_child(m_node, 0); }
@@ -282,6 +759,40 @@ namespace ts {
             ts_node_edit(&m_node, &input);
         }
     };
+    // The children of a node gathered once with their fields, indexing doesn't
+    // walk the tree again:
+    //
+    //     for (ts::Node child : node.children()) {...}
+    //
+    class Children {
+        std::vector<TSNode> m_nodes;
+        std::vector<TSFieldId> m_fields;
+    public:
+        using Iterator = const TSNode *;
+        Children() = default;
+        Children(const Node &node) { reset(node); }
+        // The buffers are kept, one Children can be reset in a loop over many nodes
+        void reset(const Node &node) {
+            m_nodes.resize(node.count());
+            m_fields.resize(m_nodes.size());
+            m_nodes.resize(ts_node_children(node.m_node, m_nodes.data(), m_fields.data(), m_nodes.size()));
+        }
+        inline uint32_t count() const { return m_nodes.size(); }
+        inline bool empty() const { return m_nodes.empty(); }
+        inline Node operator[](uint32_t index) const { return m_nodes[index]; }
+        inline TSFieldId field_id(uint32_t index) const { return m_fields[index]; }
+        // The first child with the field, or an empty node
+        Node operator[](const Field &field) const {
+            for (uint32_t i = 0; field && i < m_nodes.size(); ++i) {
+                if (m_fields[i] == field) {
+                    return m_nodes[i];
+                }
+            }
+            return TSNode();
+        }
+        inline Iterator begin() const { return m_nodes.data(); }
+        inline Iterator end() const { return m_nodes.data() + m_nodes.size(); }
+    };
     class Tree {
         friend class Parser;
         TSTree *m_tree = nullptr;
@@ -302,6 +813,10 @@ namespace ts {
             m_tree = ts_tree_copy(rhs.m_tree);;
             return *this;
         }
+        inline Tree &operator=(Tree &&rhs) {
+            std::swap(m_tree, rhs.m_tree);
+            return *this;
+        }
         inline bool empty() { return !m_tree; }
         Node root() { return ts_tree_root_node(m_tree); }
         void print_dot_graph(FILE *io) {
@@ -310,7 +825,34 @@ namespace ts {
         void edit(const TSInputEdit &input) {
             ts_tree_edit(m_tree, &input);
         }
+        // Sorted edits in the coordinates before all of them, see ts_tree_edit_batch
+        void edit(const std::vector<TSInputEdit> &inputs) {
+            ts_tree_edit_batch(m_tree, inputs.data(), inputs.size());
+        }
+        // Ranges whose structure differs from old, the edited tree this one was parsed from
+        std::vector<TSRange> changed_ranges(const Tree &old) const {
+            uint32_t count = 0;
+            TSRange *ranges = ts_tree_get_changed_ranges(old.m_tree, m_tree, &count);
+            std::vector<TSRange> result(ranges, ranges + count);
+            ts_allocation_free(ranges);
+            return result;
+        }
+        void compact() {
+            ts_tree_compact(m_tree);
+        }
+        // Constant time Node::parent(), see ts_tree_set_parent_index_enabled
+        void set_parent_index(bool enabled) {
+            ts_tree_set_parent_index_enabled(m_tree, enabled);
+        }
         Tree copy() { return Tree(*this); }
+        // One tree from the trees of consecutive pieces of a document, see ts_tree_join
+        static Tree join(const std::vector<Tree> &trees) {
+            std::vector<const TSTree *> roots;
+            for (auto &tree : trees) {
+                roots.push_back(tree.m_tree);
+            }
+            return Tree(ts_tree_join(roots.data(), roots.size()));
+        }
     };
     class Cursor {
         TSTreeCursor m_cursor;
@@ -348,11 +890,18 @@ namespace ts {
     inline Cursor Node::walk() {
         return Cursor(*this);
     }
+    inline Children Node::children() const {
+        return Children(*this);
+    }
     inline Tree Parser::parse(const std::string &str) {
         return Tree(ts_parser_parse_string(m_parser, nullptr, str.c_str(), str.length()));
     }
     inline void Parser::parse(Tree &tree, const std::string &str, TSInputEncoding encoding) {
-        tree.m_tree = ts_parser_parse_string_encoding(m_parser, tree.m_tree, str.c_str(), str.length(), encoding);
+        TSTree *old_tree = tree.m_tree;
+        tree.m_tree = ts_parser_parse_string_encoding(m_parser, old_tree, str.c_str(), str.length(), encoding);
+        if (old_tree) {
+            ts_tree_delete(old_tree);
+        }
     }
     static const char *InputRead(
             void *payload, uint32_t byte_index, TSPoint position, uint32_t *bytes_read) {
@@ -369,13 +918,28 @@ namespace ts {
         input.payload = &feeder;
         input.read = InputRead;
         input.encoding = encoding;
-        tree.m_tree = ts_parser_parse(m_parser, tree.m_tree, input);
+        TSTree *old_tree = tree.m_tree;
+        tree.m_tree = ts_parser_parse(m_parser, old_tree, input);
+        if (old_tree) {
+            ts_tree_delete(old_tree);
+        }
     }
-    inline Query::Cursor Query::exec(const Node &node) {
-        Cursor cursor;
-        ts_query_cursor_exec(cursor.m_cursor, m_query, node.m_node);
+    inline Query::Query(TSLanguage *language, const string_view &query) {
+        QueryRegistry::global().create(*this, language, query);
+    }
+    inline Query::Query(TSLanguage *language, const string_view &query, QueryRegistry &registry) {
+        registry.create(*this, language, query);
+    }
+    inline Query::Cursor Query::exec(const Node &node, CursorPool &pool) {
+        Cursor cursor(pool);
+        exec(cursor, node);
         return cursor;
     }
+    inline void Query::exec(Cursor &cursor, const Node &node) {
+        cursor.m_query = this;
+        cursor.m_passed_id = UINT32_MAX;
+        ts_query_cursor_exec(cursor.m_cursor, m_query, node.m_node);
+    }
     inline Node Query::Cursor::capture_node(uint32_t index) {
         return Node(m_match.captures[index].node);
     }
@@ -44,6 +44,7 @@ typedef struct TSQueryCursor TSQueryCursor;
 typedef enum {
   TSInputEncodingUTF8,
   TSInputEncodingUTF16,
+  TSInputEncodingUTF32,
 } TSInputEncoding;
 
 typedef enum {
@@ -80,6 +81,37 @@ typedef struct {
   void (*log)(void *payload, TSLogType, const char *);
 } TSLogger;
 
+typedef struct {
+  uint32_t max_version_count;
+  uint32_t max_cost_difference;
+  uint32_t max_summary_depth;
+  uint32_t max_node_pool_size;
+  uint32_t max_link_count;
+  uint64_t budget_micros;
+  uint64_t budget_operations;
+  uint32_t budget_version_count;
+  uint32_t budget_summary_depth;
+} TSParserLimits;
+
+typedef struct {
+  uint64_t bytes_lexed;
+  uint32_t tokens_lexed;
+  uint32_t tokens_from_cache;
+  uint32_t subtrees_reused;
+  uint32_t nodes_reused;
+  uint32_t bytes_reused;
+  uint32_t nodes_created;
+  uint32_t max_version_count;
+  uint32_t condense_count;
+  uint32_t error_count;
+  uint32_t recover_count;
+  bool over_budget;
+  uint64_t setup_micros;
+  uint64_t parse_micros;
+  uint64_t balance_micros;
+  uint64_t total_micros;
+} TSParseStats;
+
 typedef struct {
   uint32_t start_byte;
   uint32_t old_end_byte;
@@ -124,6 +156,33 @@ typedef struct {
   uint32_t value_id;
 } TSQueryPredicateStep;
 
+typedef enum {
+  TSAllocationSubsystemParser,
+  TSAllocationSubsystemLexer,
+  TSAllocationSubsystemStack,
+  TSAllocationSubsystemSubtree,
+  TSAllocationSubsystemTree,
+  TSAllocationSubsystemQuery,
+  TSAllocationSubsystemOther,
+  TSAllocationSubsystemCount,
+} TSAllocationSubsystem;
+
+typedef struct {
+  void *payload;
+  void *(*malloc)(void *payload, size_t size);
+  void *(*calloc)(void *payload, size_t count, size_t size);
+  void *(*realloc)(void *payload, void *buffer, size_t size);
+  void (*free)(void *payload, void *buffer);
+  void (*out_of_memory)(void *payload, size_t size);
+} TSAllocator;
+
+typedef struct {
+  uint64_t allocation_count;
+  uint64_t reallocation_count;
+  uint64_t free_count;
+  uint64_t allocated_bytes;
+} TSAllocationStats;
+
 typedef enum {
   TSQueryErrorNone = 0,
   TSQueryErrorSyntax,
@@ -225,8 +284,9 @@ const TSRange *ts_parser_included_ranges(
  *    `bytes_read` pointer to indicate the end of the document.
  * 2. `payload`: An arbitrary pointer that will be passed to each invocation
  *    of the `read` function.
- * 3. `encoding`: An indication of how the text is encoded. Either
- *    `TSInputEncodingUTF8` or `TSInputEncodingUTF16`.
+ * 3. `encoding`: An indication of how the text is encoded. One of
+ *    `TSInputEncodingUTF8`, `TSInputEncodingUTF16` or `TSInputEncodingUTF32`,
+ *    where UTF16 and UTF32 are in the machine's byte order.
  *
  * This function returns a syntax tree on success, and `NULL` on failure. There
  * are three possible reasons for failure:
@@ -300,6 +360,58 @@ void ts_parser_set_timeout_micros(TSParser *self, uint64_t timeout);
  */
 uint64_t ts_parser_timeout_micros(const TSParser *self);
 
+/**
+ * Get the default limits that bound the parser's work on ambiguous or
+ * erroneous input.
+ */
+TSParserLimits ts_parser_default_limits(void);
+
+/**
+ * Set the limits that bound the parser's work on ambiguous or erroneous input,
+ * or restore the defaults by passing `NULL`. The fields are:
+ * 1. `max_version_count`: The number of GLR stack versions that are kept
+ *    alive at once.
+ * 2. `max_cost_difference`: How much worse a version's error cost may be than
+ *    another's, scaled by its node count, before it is discarded.
+ * 3. `max_summary_depth`: How far down the stack error recovery searches for
+ *    a previous state that accepts the lookahead token.
+ * 4. `max_node_pool_size`: The number of freed stack nodes kept for reuse.
+ * 5. `max_link_count`: The number of predecessors one stack node may merge,
+ *    at most 8.
+ * 6. `budget_micros` and `budget_operations`: A latency budget for each call
+ *    to `ts_parser_parse`, zero means unlimited. Once either is exceeded, the
+ *    parse continues with only `budget_version_count` versions and a recovery
+ *    search depth of `budget_summary_depth`, which trades the quality of
+ *    error recovery for a bounded parse time.
+ */
+void ts_parser_set_limits(TSParser *self, const TSParserLimits *limits);
+
+/**
+ * Get the parser's current limits.
+ */
+TSParserLimits ts_parser_limits(const TSParser *self);
+
+/**
+ * Get the statistics of the parser's last parse. They are reset when a new
+ * parse starts, and accumulate over the calls that resume a halted parse.
+ * The fields are:
+ * 1. `bytes_lexed` and `tokens_lexed`: The work done by the lexer, including
+ *    the lookahead it read past each token. `tokens_from_cache` counts the
+ *    tokens that were taken from the token cache instead.
+ * 2. `subtrees_reused`, `nodes_reused` and `bytes_reused`: The subtrees taken
+ *    whole from the old tree, the nodes they contain and the bytes they span.
+ * 3. `nodes_created`: The internal nodes built by reductions and recovery.
+ * 4. `max_version_count` and `condense_count`: The peak number of stack
+ *    versions and the number of rounds in which the versions were condensed.
+ * 5. `error_count` and `recover_count`: The number of times error handling
+ *    started and the number of recovery attempts.
+ * 6. `over_budget`: Whether the latency budget of the limits was exceeded.
+ * 7. `setup_micros`, `parse_micros`, `balance_micros` and `total_micros`:
+ *    The wall time spent preparing the parse, running the parse loop,
+ *    balancing the finished tree and in total.
+ */
+TSParseStats ts_parser_stats(const TSParser *self);
+
 /**
  * Set the parser's current cancellation flag pointer.
  *
@@ -372,6 +484,59 @@ const TSLanguage *ts_tree_language(const TSTree *);
  */
 void ts_tree_edit(TSTree *self, const TSInputEdit *edit);
 
+/**
+ * Edit the syntax tree to keep it in sync with source code that has been
+ * edited in several places at once, like a find and replace.
+ *
+ * The edits must be sorted by position and must not overlap. Each one is
+ * described in the coordinates of the source code before any of the edits,
+ * the same as if they were passed to `ts_tree_edit` one at a time, from the
+ * last to the first. The tree is only walked once for all of them.
+ */
+void ts_tree_edit_batch(TSTree *self, const TSInputEdit *edits, uint32_t count);
+
+/**
+ * Copy the syntax tree's nodes into one contiguous block of memory, in the
+ * order that a depth-first walk visits them.
+ *
+ * After many incremental reparses, the nodes of a tree are spread across the
+ * heap. Compacting the tree in idle time makes later walks and queries more
+ * cache friendly. Nodes retrieved from the tree before it was compacted must
+ * not be used afterward. Copies of the tree made with `ts_tree_copy` are not
+ * affected.
+ */
+void ts_tree_compact(TSTree *self);
+
+/**
+ * Join syntax trees that were parsed separately from consecutive pieces of
+ * one document into a single tree for the whole document.
+ *
+ * Each piece must start at the beginning of a line, and all of the trees must
+ * have been parsed with the same language, whose root rule repeats its
+ * children. The children of the roots are placed under a new root node, in
+ * order. The given trees are not modified, and can be deleted afterward.
+ */
+TSTree *ts_tree_join(const TSTree *const *trees, uint32_t count);
+
+/**
+ * Enable or disable the syntax tree's parent index.
+ *
+ * Without the index, `ts_node_parent` searches down from the root for any
+ * node that isn't in a small cache of recently visited parents. With it,
+ * the parent of every visible node is found in constant time. The index is
+ * built by the first `ts_node_parent` call that needs it, with one walk over
+ * the tree. It takes about 35 bytes per visible node.
+ *
+ * `ts_tree_edit` keeps the index, the positions of the parents found in it
+ * are moved for the edits made since it was built. After 64 edits, or an
+ * edit that reaches nodes shared with a copy of the tree, the index is
+ * dropped until it is needed again, as it is by `ts_tree_compact`. A tree
+ * parsed from an old tree doesn't have the index enabled, even if the old
+ * tree did, since building it for every new tree would cost more than most
+ * reparses.
+ */
+void ts_tree_set_parent_index_enabled(TSTree *self, bool enabled);
+
 /**
  * Compare an old edited syntax tree to a new syntax tree representing the same
  * document, returning an array of ranges whose syntactic structure has changed.
@@ -382,9 +547,9 @@ void ts_tree_edit(TSTree *self, const TSInputEdit *edit);
  * You need to pass the old tree that was passed to parse, as well as the new
  * tree that was returned from that function.
  *
- * The returned array is allocated using `malloc` and the caller is responsible
- * for freeing it using `free`. The length of the array will be written to the
- * given `length` pointer.
+ * The returned array is allocated with the library's allocator and the caller
+ * is responsible for freeing it using `ts_allocation_free`. The length of the
+ * array will be written to the given `length` pointer.
  */
 TSRange *ts_tree_get_changed_ranges(
   const TSTree *old_tree,
@@ -434,8 +599,8 @@ TSPoint ts_node_end_point(TSNode);
 /**
  * Get an S-expression representing the node as a string.
  *
- * This string is allocated with `malloc` and the caller is responsible for
- * freeing it using `free`.
+ * This string is allocated with the library's allocator and the caller is
+ * responsible for freeing it using `ts_allocation_free`.
  */
 char *ts_node_string(TSNode);
 
@@ -491,6 +656,33 @@ TSNode ts_node_child(TSNode, uint32_t);
  */
 uint32_t ts_node_child_count(TSNode);
 
+/**
+ * Write the node's children into `children` in one pass over its hidden
+ * descendants, where a loop of `ts_node_child` calls walks them again for
+ * every index. When `fields` is not NULL, it receives the field id of each
+ * child, or zero for a child without a field.
+ *
+ * At most `capacity` children are written, and the number written is
+ * returned. A buffer of `ts_node_child_count` nodes holds all of them.
+ */
+uint32_t ts_node_children(TSNode, TSNode *children, TSFieldId *fields, uint32_t capacity);
+
+/**
+ * Find the node's descendants with the given symbol, in document order.
+ *
+ * Every subtree records which symbols occur below it, so the search skips the
+ * subtrees that can't hold the symbol and a rare symbol is found without
+ * walking the whole tree. At most `capacity` nodes are written, and the total
+ * number found is returned, so a second call with a larger buffer gets the
+ * rest. The node itself is not included.
+ */
+uint32_t ts_node_descendants_for_symbol(
+  TSNode,
+  TSSymbol symbol,
+  TSNode *nodes,
+  uint32_t capacity
+);
+
 /**
  * Get the node's *named* child at the given index.
  *
@@ -681,6 +873,36 @@ TSQuery *ts_query_new(
  */
 void ts_query_delete(TSQuery *);
 
+/**
+ * Create a copy of a query, including the patterns and captures that were
+ * disabled in it. Disabling more of them in one copy doesn't affect the other.
+ */
+TSQuery *ts_query_copy(const TSQuery *);
+
+/**
+ * Write the compiled form of a query to a binary blob, so that the same query
+ * can be created again later without parsing its source.
+ *
+ * The blob is allocated with the library's allocator and the caller is
+ * responsible for freeing it using `ts_allocation_free`. Its length is written to the given `length`
+ * pointer. Patterns and captures that were disabled stay disabled.
+ */
+void *ts_query_serialize(const TSQuery *, uint32_t *length);
+
+/**
+ * Create a query from a blob written by `ts_query_serialize`.
+ *
+ * This returns `NULL` when the blob is damaged, was written by a different
+ * build of the library, or was compiled for a language whose symbols or
+ * fields differ from the given one. The caller can then compile the query
+ * from its source with `ts_query_new`.
+ */
+TSQuery *ts_query_deserialize(
+  const TSLanguage *language,
+  const void *data,
+  uint32_t length
+);
+
 /**
  * Get the number of patterns, captures, or string literals in the query.
  */
@@ -696,6 +918,16 @@ uint32_t ts_query_string_count(const TSQuery *);
  */
 uint32_t ts_query_start_byte_for_pattern(const TSQuery *, uint32_t);
 
+/**
+ * Get the depth of the deepest node in the query's patterns that a node of the
+ * given symbol can match, or `UINT32_MAX` if none can. The root node of a
+ * pattern has depth zero.
+ *
+ * Every node from a match's root down to any of its nodes is part of the
+ * match, so the root is at most this many levels above a node of the symbol.
+ */
+uint32_t ts_query_max_depth_for_symbol(const TSQuery *, TSSymbol);
+
 /**
  * Get all of the predicates for the given pattern in the query.
  *
@@ -792,6 +1024,22 @@ void ts_query_cursor_exec(TSQueryCursor *, const TSQuery *, TSNode);
 void ts_query_cursor_set_byte_range(TSQueryCursor *, uint32_t, uint32_t);
 void ts_query_cursor_set_point_range(TSQueryCursor *, TSPoint, TSPoint);
 
+/**
+ * Set the maximum number of matches that the cursor keeps in progress at
+ * once. Beyond it, the match that started earliest is dropped to make room,
+ * and the cursor's overflow count goes up. The limit applies from the next
+ * `ts_query_cursor_exec`. It defaults to the most the cursor can track,
+ * which is also what `UINT32_MAX` means.
+ */
+void ts_query_cursor_set_match_limit(TSQueryCursor *, uint32_t);
+uint32_t ts_query_cursor_match_limit(const TSQueryCursor *);
+
+/**
+ * Get the number of in-progress matches the cursor has dropped because of
+ * its match limit since the last `ts_query_cursor_exec`.
+ */
+uint32_t ts_query_cursor_overflow_count(const TSQueryCursor *);
+
 const char *ts_query_cursor_get_name(TSQueryCursor *, uint32_t , uint32_t *length);
 
 /**
@@ -871,6 +1119,91 @@ TSSymbolType ts_language_symbol_type(const TSLanguage *, TSSymbol);
  */
 uint32_t ts_language_version(const TSLanguage *);
 
+/************************/
+/* Section - Allocation */
+/************************/
+
+/**
+ * Set the allocator used for all of the library's memory, or restore the
+ * C standard library functions by passing `NULL`.
+ *
+ * The allocator is process-wide, so this must be called before any parser,
+ * tree or query exists, or after all of them have been deleted. The `calloc`
+ * function is optional and is emulated with `malloc` when it is missing. When
+ * an allocation fails, `out_of_memory` is called if it is set. Otherwise the
+ * library prints an error and exits the process.
+ *
+ * Allocations are not tagged with the calling thread, so an allocator that
+ * routes memory to per-thread arenas must be able to free memory that was
+ * allocated on another thread.
+ */
+void ts_set_allocator(const TSAllocator *allocator);
+
+/**
+ * Free a buffer that the library returned to the caller, such as the string
+ * of `ts_node_string` or the array of `ts_tree_get_changed_ranges`. The buffer
+ * goes back to the allocator that is set, so it must not be passed to `free`
+ * once an allocator has been set with `ts_set_allocator`.
+ */
+void ts_allocation_free(void *buffer);
+
+/**
+ * Enable or disable allocation statistics. They are disabled by default,
+ * because the counters are updated atomically on every allocation.
+ */
+void ts_set_allocation_stats_enabled(bool enabled);
+
+/**
+ * Get the allocation counts and bytes of one subsystem since statistics
+ * were enabled or last reset.
+ *
+ * Allocations are attributed to the subsystem that made them, frees to the
+ * subsystem that released the memory, which is not always the same one.
+ * Reallocations count their new size in `allocated_bytes`.
+ */
+TSAllocationStats ts_allocation_stats(TSAllocationSubsystem subsystem);
+
+/**
+ * Reset the allocation statistics of every subsystem to zero.
+ */
+void ts_allocation_stats_reset(void);
+
+/*********************/
+/* Section - Tracing */
+/*********************/
+
+/**
+ * Get the current time in nanoseconds, for the start and end of a trace span.
+ *
+ * Tracing is compiled in only when the library is built with
+ * `TREE_SITTER_TRACE` defined. Otherwise these functions do nothing, and the
+ * runtime's own spans are not compiled at all.
+ */
+uint64_t ts_trace_now(void);
+
+/**
+ * Record a completed span that started and ended at the given times. The
+ * category and name must be string literals or otherwise outlive the trace.
+ *
+ * Each thread records into its own ring buffer, without taking any locks,
+ * and the oldest spans are overwritten once the buffer is full.
+ */
+void ts_trace_record(const char *category, const char *name, uint64_t start, uint64_t end);
+
+/**
+ * Discard the recorded spans of every thread.
+ */
+void ts_trace_clear(void);
+
+/**
+ * Write the recorded spans of every thread to a file in the Chrome trace
+ * event format, which can be opened in Perfetto or `chrome://tracing`.
+ *
+ * Neither this nor `ts_trace_clear` synchronizes with the recording threads,
+ * so call them while no spans are being recorded.
+ */
+void ts_trace_write_chrome_json(FILE *file);
+
 #ifdef __cplusplus
 }
 #endif
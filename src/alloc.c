@@ -0,0 +1,132 @@
+#include <string.h>
+#include "./alloc.h"
+#include "./atomic.h"
+
+#if defined(TREE_SITTER_TEST)
+
+void *ts_record_malloc(size_t);
+void *ts_record_calloc(size_t, size_t);
+void *ts_record_realloc(void *, size_t);
+void ts_record_free(void *);
+
+#define ts_default_malloc ts_record_malloc
+#define ts_default_calloc ts_record_calloc
+#define ts_default_realloc ts_record_realloc
+#define ts_default_free ts_record_free
+
+#else
+
+#define ts_default_malloc malloc
+#define ts_default_calloc calloc
+#define ts_default_realloc realloc
+#define ts_default_free free
+
+#endif
+
+static TSAllocator ts_allocator;
+static bool ts_allocator_is_set = false;
+static bool ts_allocation_stats_enabled = false;
+static TSAllocationStats ts_allocation_stats_table[TSAllocationSubsystemCount];
+
+static inline TSAllocationStats *ts_allocation__stats(TSAllocationSubsystem subsystem) {
+  if ((unsigned)subsystem >= TSAllocationSubsystemCount) subsystem = TSAllocationSubsystemOther;
+  return &ts_allocation_stats_table[subsystem];
+}
+
+static void *ts_allocation__check(void *result, size_t size) {
+  if (size > 0 && !result) {
+    if (ts_allocator_is_set && ts_allocator.out_of_memory) {
+      ts_allocator.out_of_memory(ts_allocator.payload, size);
+    }
+    fprintf(stderr, "tree-sitter failed to allocate %lu bytes", (unsigned long)size);
+    exit(1);
+  }
+  return result;
+}
+
+void *ts_allocator_malloc(TSAllocationSubsystem subsystem, size_t size) {
+  void *result = ts_allocator_is_set ?
+    ts_allocator.malloc(ts_allocator.payload, size) :
+    ts_default_malloc(size);
+  if (ts_allocation_stats_enabled) {
+    TSAllocationStats *stats = ts_allocation__stats(subsystem);
+    atomic_add64(&stats->allocation_count, 1);
+    atomic_add64(&stats->allocated_bytes, size);
+  }
+  return ts_allocation__check(result, size);
+}
+
+void *ts_allocator_calloc(TSAllocationSubsystem subsystem, size_t count, size_t size) {
+  void *result;
+  if (!ts_allocator_is_set) {
+    result = ts_default_calloc(count, size);
+  } else if (ts_allocator.calloc) {
+    result = ts_allocator.calloc(ts_allocator.payload, count, size);
+  } else {
+    result = ts_allocator.malloc(ts_allocator.payload, count * size);
+    if (result) memset(result, 0, count * size);
+  }
+  if (ts_allocation_stats_enabled) {
+    TSAllocationStats *stats = ts_allocation__stats(subsystem);
+    atomic_add64(&stats->allocation_count, 1);
+    atomic_add64(&stats->allocated_bytes, count * size);
+  }
+  return ts_allocation__check(result, count * size);
+}
+
+void *ts_allocator_realloc(TSAllocationSubsystem subsystem, void *buffer, size_t size) {
+  void *result = ts_allocator_is_set ?
+    ts_allocator.realloc(ts_allocator.payload, buffer, size) :
+    ts_default_realloc(buffer, size);
+  if (ts_allocation_stats_enabled) {
+    TSAllocationStats *stats = ts_allocation__stats(subsystem);
+    atomic_add64(&stats->reallocation_count, 1);
+    atomic_add64(&stats->allocated_bytes, size);
+  }
+  return ts_allocation__check(result, size);
+}
+
+void ts_allocator_free(TSAllocationSubsystem subsystem, void *buffer) {
+  if (!buffer) return;
+  if (ts_allocator_is_set) {
+    ts_allocator.free(ts_allocator.payload, buffer);
+  } else {
+    ts_default_free(buffer);
+  }
+  if (ts_allocation_stats_enabled) {
+    atomic_add64(&ts_allocation__stats(subsystem)->free_count, 1);
+  }
+}
+
+void ts_allocation_free(void *buffer) {
+  ts_allocator_free(TSAllocationSubsystemOther, buffer);
+}
+
+void ts_set_allocator(const TSAllocator *allocator) {
+  if (allocator && allocator->malloc && allocator->realloc && allocator->free) {
+    ts_allocator = *allocator;
+    ts_allocator_is_set = true;
+  } else {
+    memset(&ts_allocator, 0, sizeof(ts_allocator));
+    ts_allocator_is_set = false;
+  }
+}
+
+void ts_set_allocation_stats_enabled(bool enabled) {
+  ts_allocation_stats_enabled = enabled;
+}
+
+TSAllocationStats ts_allocation_stats(TSAllocationSubsystem subsystem) {
+  TSAllocationStats *stats = ts_allocation__stats(subsystem);
+  TSAllocationStats result = {
+    .allocation_count = atomic_add64(&stats->allocation_count, 0),
+    .reallocation_count = atomic_add64(&stats->reallocation_count, 0),
+    .free_count = atomic_add64(&stats->free_count, 0),
+    .allocated_bytes = atomic_add64(&stats->allocated_bytes, 0),
+  };
+  return result;
+}
+
+void ts_allocation_stats_reset(void) {
+  memset(ts_allocation_stats_table, 0, sizeof(ts_allocation_stats_table));
+}
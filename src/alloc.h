@@ -8,71 +8,43 @@ extern "C" {
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include "tree_sitter/api.h"
+
+// Each source file defines the subsystem its allocations are attributed to.
+// The allocation macros expand it at the call site, so allocations made by
+// the inline array functions are attributed to the file that uses the array.
+#ifndef TS_ALLOCATION_SUBSYSTEM
+#define TS_ALLOCATION_SUBSYSTEM TSAllocationSubsystemOther
+#endif
 
 #if defined(TREE_SITTER_TEST)
 
-void *ts_record_malloc(size_t);
-void *ts_record_calloc(size_t, size_t);
-void *ts_record_realloc(void *, size_t);
-void ts_record_free(void *);
 bool ts_toggle_allocation_recording(bool);
 
-static inline void *ts_malloc(size_t size) {
-  return ts_record_malloc(size);
-}
-
-static inline void *ts_calloc(size_t count, size_t size) {
-  return ts_record_calloc(count, size);
-}
-
-static inline void *ts_realloc(void *buffer, size_t size) {
-  return ts_record_realloc(buffer, size);
-}
-
-static inline void ts_free(void *buffer) {
-  ts_record_free(buffer);
-}
-
 #else
 
-#include <stdlib.h>
-
 static inline bool ts_toggle_allocation_recording(bool value) {
   return false;
 }
 
-static inline void *ts_malloc(size_t size) {
-  void *result = malloc(size);
-  if (size > 0 && !result) {
-    fprintf(stderr, "tree-sitter failed to allocate %lu bytes", size);
-    exit(1);
-  }
-  return result;
-}
+#endif
 
-static inline void *ts_calloc(size_t count, size_t size) {
-  void *result = calloc(count, size);
-  if (count > 0 && !result) {
-    fprintf(stderr, "tree-sitter failed to allocate %lu bytes", count * size);
-    exit(1);
-  }
-  return result;
-}
+void *ts_allocator_malloc(TSAllocationSubsystem, size_t);
+void *ts_allocator_calloc(TSAllocationSubsystem, size_t, size_t);
+void *ts_allocator_realloc(TSAllocationSubsystem, void *, size_t);
+void ts_allocator_free(TSAllocationSubsystem, void *);
 
-static inline void *ts_realloc(void *buffer, size_t size) {
-  void *result = realloc(buffer, size);
-  if (size > 0 && !result) {
-    fprintf(stderr, "tree-sitter failed to reallocate %lu bytes", size);
-    exit(1);
-  }
-  return result;
-}
+#define ts_malloc(size) \
+  ts_allocator_malloc(TS_ALLOCATION_SUBSYSTEM, size)
 
-static inline void ts_free(void *buffer) {
-  free(buffer);
-}
+#define ts_calloc(count, size) \
+  ts_allocator_calloc(TS_ALLOCATION_SUBSYSTEM, count, size)
 
-#endif
+#define ts_realloc(buffer, size) \
+  ts_allocator_realloc(TS_ALLOCATION_SUBSYSTEM, buffer, size)
+
+#define ts_free(buffer) \
+  ts_allocator_free(TS_ALLOCATION_SUBSYSTEM, buffer)
 
 #ifdef __cplusplus
 }
@@ -35,19 +35,19 @@ extern "C" {
 #define array_clear(self) ((self)->size = 0)
 
 #define array_reserve(self, new_capacity) \
-  array__reserve((VoidArray *)(self), array__elem_size(self), new_capacity)
+  array__reserve((VoidArray *)(self), array__elem_size(self), new_capacity, TS_ALLOCATION_SUBSYSTEM)
 
 #define array_erase(self, index) \
   array__erase((VoidArray *)(self), array__elem_size(self), index)
 
-#define array_delete(self) array__delete((VoidArray *)self)
+#define array_delete(self) array__delete((VoidArray *)self, TS_ALLOCATION_SUBSYSTEM)
 
 #define array_push(self, element)                            \
-  (array__grow((VoidArray *)(self), 1, array__elem_size(self)), \
+  (array__grow((VoidArray *)(self), 1, array__elem_size(self), TS_ALLOCATION_SUBSYSTEM), \
    (self)->contents[(self)->size++] = (element))
 
 #define array_grow_by(self, count) \
-  (array__grow((VoidArray *)(self), count, array__elem_size(self)), \
+  (array__grow((VoidArray *)(self), count, array__elem_size(self), TS_ALLOCATION_SUBSYSTEM), \
    memset((self)->contents + (self)->size, 0, (count) * array__elem_size(self)), \
    (self)->size += (count))
 
@@ -56,15 +56,17 @@ extern "C" {
 
 #define array_splice(self, index, old_count, new_count, new_contents)          \
   array__splice((VoidArray *)(self), array__elem_size(self), index, old_count, \
-                new_count, new_contents)
+                new_count, new_contents, TS_ALLOCATION_SUBSYSTEM)
 
 #define array_insert(self, index, element) \
-  array__splice((VoidArray *)(self), array__elem_size(self), index, 0, 1, &element)
+  array__splice((VoidArray *)(self), array__elem_size(self), index, 0, 1, &element, \
+                TS_ALLOCATION_SUBSYSTEM)
 
 #define array_pop(self) ((self)->contents[--(self)->size])
 
 #define array_assign(self, other) \
-  array__assign((VoidArray *)(self), (const VoidArray *)(other), array__elem_size(self))
+  array__assign((VoidArray *)(self), (const VoidArray *)(other), array__elem_size(self), \
+                TS_ALLOCATION_SUBSYSTEM)
 
 // Private
 
@@ -72,8 +74,8 @@ typedef Array(void) VoidArray;
 
 #define array__elem_size(self) sizeof(*(self)->contents)
 
-static inline void array__delete(VoidArray *self) {
-  ts_free(self->contents);
+static inline void array__delete(VoidArray *self, TSAllocationSubsystem subsystem) {
+  ts_allocator_free(subsystem, self->contents);
   self->contents = NULL;
   self->size = 0;
   self->capacity = 0;
@@ -88,42 +90,46 @@ static inline void array__erase(VoidArray *self, size_t element_size,
   self->size--;
 }
 
-static inline void array__reserve(VoidArray *self, size_t element_size, uint32_t new_capacity) {
+static inline void array__reserve(VoidArray *self, size_t element_size, uint32_t new_capacity,
+                                  TSAllocationSubsystem subsystem) {
   if (new_capacity > self->capacity) {
     if (self->contents) {
-      self->contents = ts_realloc(self->contents, new_capacity * element_size);
+      self->contents = ts_allocator_realloc(subsystem, self->contents, new_capacity * element_size);
     } else {
-      self->contents = ts_calloc(new_capacity, element_size);
+      self->contents = ts_allocator_calloc(subsystem, new_capacity, element_size);
     }
     self->capacity = new_capacity;
   }
 }
 
-static inline void array__assign(VoidArray *self, const VoidArray *other, size_t element_size) {
-  array__reserve(self, element_size, other->size);
+static inline void array__assign(VoidArray *self, const VoidArray *other, size_t element_size,
+                                 TSAllocationSubsystem subsystem) {
+  array__reserve(self, element_size, other->size, subsystem);
   self->size = other->size;
   memcpy(self->contents, other->contents, self->size * element_size);
 }
 
-static inline void array__grow(VoidArray *self, size_t count, size_t element_size) {
+static inline void array__grow(VoidArray *self, size_t count, size_t element_size,
+                               TSAllocationSubsystem subsystem) {
   size_t new_size = self->size + count;
   if (new_size > self->capacity) {
     size_t new_capacity = self->capacity * 2;
     if (new_capacity < 8) new_capacity = 8;
     if (new_capacity < new_size) new_capacity = new_size;
-    array__reserve(self, element_size, new_capacity);
+    array__reserve(self, element_size, new_capacity, subsystem);
   }
 }
 
 static inline void array__splice(VoidArray *self, size_t element_size,
                                  uint32_t index, uint32_t old_count,
-                                 uint32_t new_count, const void *elements) {
+                                 uint32_t new_count, const void *elements,
+                                 TSAllocationSubsystem subsystem) {
   uint32_t new_size = self->size + new_count - old_count;
   uint32_t old_end = index + old_count;
   uint32_t new_end = index + new_count;
   assert(old_end <= self->size);
 
-  array__reserve(self, element_size, new_size);
+  array__reserve(self, element_size, new_size, subsystem);
 
   char *contents = (char *)self->contents;
   if (self->size > old_end) {
@@ -1,6 +1,7 @@
 #ifndef TREE_SITTER_ATOMIC_H_
 #define TREE_SITTER_ATOMIC_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef _WIN32
@@ -19,6 +20,14 @@ static inline uint32_t atomic_dec(volatile uint32_t *p) {
   return InterlockedDecrement((long volatile *)p);
 }
 
+static inline uint64_t atomic_add64(uint64_t *p, uint64_t value) {
+  return InterlockedExchangeAdd64((LONGLONG volatile *)p, value) + value;
+}
+
+static inline bool atomic_compare_exchange_ptr(void *volatile *p, void *expected, void *value) {
+  return InterlockedCompareExchangePointer(p, value, expected) == expected;
+}
+
 #else
 
 static inline size_t atomic_load(const volatile size_t *p) {
@@ -37,6 +46,14 @@ static inline uint32_t atomic_dec(volatile uint32_t *p) {
   return __sync_sub_and_fetch(p, 1u);
 }
 
+static inline uint64_t atomic_add64(uint64_t *p, uint64_t value) {
+  return __sync_add_and_fetch(p, value);
+}
+
+static inline bool atomic_compare_exchange_ptr(void *volatile *p, void *expected, void *value) {
+  return __sync_bool_compare_and_swap(p, expected, value);
+}
+
 #endif
 
 #endif  // TREE_SITTER_ATOMIC_H_
@@ -1,9 +1,13 @@
+#undef TS_ALLOCATION_SUBSYSTEM
+#define TS_ALLOCATION_SUBSYSTEM TSAllocationSubsystemTree
+
 #include "./get_changed_ranges.h"
 #include "./subtree.h"
 #include "./language.h"
 #include "./error_costs.h"
 #include "./tree_cursor.h"
 #include <assert.h>
+#include <string.h>
 
 // #define DEBUG_GET_CHANGED_RANGES
 
@@ -25,14 +29,18 @@ static void ts_range_array_add(TSRangeArray *self, Length start, Length end) {
 
 bool ts_range_array_intersects(const TSRangeArray *self, unsigned start_index,
                                uint32_t start_byte, uint32_t end_byte) {
-  for (unsigned i = start_index; i < self->size; i++) {
-    TSRange *range = &self->contents[i];
-    if (range->end_byte > start_byte) {
-      if (range->start_byte >= end_byte) break;
-      return true;
+  // The ranges are sorted and disjoint, so bisect for the first one that
+  // ends after the start byte.
+  unsigned low = start_index, high = self->size;
+  while (low < high) {
+    unsigned mid = low + (high - low) / 2;
+    if (self->contents[mid].end_byte > start_byte) {
+      high = mid;
+    } else {
+      low = mid + 1;
     }
   }
-  return false;
+  return low < self->size && self->contents[low].start_byte < end_byte;
 }
 
 void ts_range_array_get_changed_ranges(
@@ -40,6 +48,12 @@ void ts_range_array_get_changed_ranges(
   const TSRange *new_ranges, unsigned new_range_count,
   TSRangeArray *differences
 ) {
+  // Reparsing with the same ranges is the common case, and has no differences.
+  if (
+    old_range_count == new_range_count &&
+    (old_ranges == new_ranges || !memcmp(old_ranges, new_ranges, old_range_count * sizeof(TSRange)))
+  ) return;
+
   unsigned new_index = 0;
   unsigned old_index = 0;
   Length current_position = length_zero();
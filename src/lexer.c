@@ -1,3 +1,6 @@
+#undef TS_ALLOCATION_SUBSYSTEM
+#define TS_ALLOCATION_SUBSYSTEM TSAllocationSubsystemLexer
+
 #include <stdio.h>
 #include "./lexer.h"
 #include "./subtree.h"
@@ -68,6 +71,22 @@ static void ts_lexer__get_chunk(Lexer *self) {
   }
 }
 
+static inline uint32_t ts_lexer__decode(
+  const Lexer *self,
+  const uint8_t *string,
+  uint32_t length,
+  int32_t *code_point
+) {
+  switch (self->input.encoding) {
+    case TSInputEncodingUTF8:
+      return ts_decode_utf8(string, length, code_point);
+    case TSInputEncodingUTF16:
+      return ts_decode_utf16(string, length, code_point);
+    default:
+      return ts_decode_utf32(string, length, code_point);
+  }
+}
+
 // Decode the next unicode character in the current chunk of source code.
 // This assumes that the lexer has already retrieved a chunk of source
 // code that spans the current position.
@@ -82,11 +101,26 @@ static void ts_lexer__get_lookahead(Lexer *self) {
     return;
   }
 
-  UnicodeDecodeFunction decode = self->input.encoding == TSInputEncodingUTF8
-    ? ts_decode_utf8
-    : ts_decode_utf16;
+  // Most source code is ASCII, which needs no decoding.
+  if (self->input.encoding == TSInputEncodingUTF8) {
+    if (chunk[0] < 0x80) {
+      self->lookahead_size = 1;
+      self->data.lookahead = chunk[0];
+      return;
+    }
+  } else if (self->input.encoding == TSInputEncodingUTF16) {
+    if (size >= 2 && *(const uint16_t *)chunk < 0x80) {
+      self->lookahead_size = 2;
+      self->data.lookahead = *(const uint16_t *)chunk;
+      return;
+    }
+  } else if (size >= 4 && *(const uint32_t *)chunk < 0x80) {
+    self->lookahead_size = 4;
+    self->data.lookahead = *(const uint32_t *)chunk;
+    return;
+  }
 
-  self->lookahead_size = decode(chunk, size, &self->data.lookahead);
+  self->lookahead_size = ts_lexer__decode(self, chunk, size, &self->data.lookahead);
 
   // If this chunk ended in the middle of a multi-byte character,
   // try again with a fresh chunk.
@@ -94,11 +128,12 @@ static void ts_lexer__get_lookahead(Lexer *self) {
     ts_lexer__get_chunk(self);
     chunk = (const uint8_t *)self->chunk;
     size = self->chunk_size;
-    self->lookahead_size = decode(chunk, size, &self->data.lookahead);
+    self->lookahead_size = ts_lexer__decode(self, chunk, size, &self->data.lookahead);
   }
 
+  // Skip an invalid UTF32 code unit as a whole, to stay aligned.
   if (self->data.lookahead == TS_DECODE_ERROR) {
-    self->lookahead_size = 1;
+    self->lookahead_size = self->input.encoding == TSInputEncodingUTF32 && size >= 4 ? 4 : 1;
   }
 }
 
@@ -247,25 +282,63 @@ void ts_lexer_delete(Lexer *self) {
   ts_free(self->included_ranges);
 }
 
+// Find the first included range that ends after the given byte. The lexer
+// usually moves a short distance, so gallop outward from the current range
+// before bisecting, rather than scanning the ranges from the start.
+static size_t ts_lexer__find_included_range(const Lexer *self, uint32_t byte) {
+  const TSRange *ranges = self->included_ranges;
+  size_t count = self->included_range_count;
+  size_t hint = self->current_included_range_index;
+  if (hint > count) hint = count;
+
+  size_t low, high, step = 1;
+  if (hint < count && ranges[hint].end_byte <= byte) {
+    low = hint + 1;
+    high = low;
+    while (high < count && ranges[high].end_byte <= byte) {
+      low = high + 1;
+      high = low + step;
+      step *= 2;
+    }
+    if (high > count) high = count;
+  } else {
+    low = hint;
+    high = hint;
+    while (low > 0 && ranges[low - 1].end_byte > byte) {
+      high = low - 1;
+      low = low > step ? low - step : 0;
+      step *= 2;
+    }
+  }
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (ranges[mid].end_byte > byte) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return low;
+}
+
 static void ts_lexer_goto(Lexer *self, Length position) {
   self->current_position = position;
   bool found_included_range = false;
 
   // Move to the first valid position at or after the given position.
-  for (unsigned i = 0; i < self->included_range_count; i++) {
-    TSRange *included_range = &self->included_ranges[i];
-    if (included_range->end_byte > position.bytes) {
-      if (included_range->start_byte > position.bytes) {
-        self->current_position = (Length) {
-          .bytes = included_range->start_byte,
-          .extent = included_range->start_point,
-        };
-      }
-
-      self->current_included_range_index = i;
-      found_included_range = true;
-      break;
+  size_t index = ts_lexer__find_included_range(self, position.bytes);
+  if (index < self->included_range_count) {
+    TSRange *included_range = &self->included_ranges[index];
+    if (included_range->start_byte > position.bytes) {
+      self->current_position = (Length) {
+        .bytes = included_range->start_byte,
+        .extent = included_range->start_point,
+      };
     }
+
+    self->current_included_range_index = index;
+    found_included_range = true;
   }
 
   if (found_included_range) {
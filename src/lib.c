@@ -5,6 +5,7 @@
 
 #define _POSIX_C_SOURCE 200112L
 
+#include "./alloc.c"
 #include "./get_changed_ranges.c"
 #include "./language.c"
 #include "./lexer.c"
@@ -13,5 +14,6 @@
 #include "./query.c"
 #include "./stack.c"
 #include "./subtree.c"
+#include "./trace.c"
 #include "./tree_cursor.c"
 #include "./tree.c"
@@ -1,3 +1,6 @@
+#undef TS_ALLOCATION_SUBSYSTEM
+#define TS_ALLOCATION_SUBSYSTEM TSAllocationSubsystemTree
+
 #include <stdbool.h>
 #include "./subtree.h"
 #include "./tree.h"
@@ -506,6 +509,90 @@ TSNode ts_node_named_child(TSNode self, uint32_t child_index) {
   return ts_node__child(self, child_index, false);
 }
 
+// Append the visible children of a node to the buffer, descending into the
+// hidden ones. A hidden child passes its own field down to its children that
+// have no field of their own, like `ts_tree_cursor_current_field_id`.
+static uint32_t ts_node__children(
+  TSNode self,
+  TSFieldId self_field,
+  TSNode *children,
+  TSFieldId *fields,
+  uint32_t count,
+  uint32_t capacity
+) {
+  const TSFieldMapEntry *field_map = NULL, *field_map_end = NULL;
+  if (fields) {
+    ts_language_field_map(
+      self.tree->language,
+      ts_node__subtree(self).ptr->production_id,
+      &field_map,
+      &field_map_end
+    );
+  }
+
+  TSNode child;
+  NodeChildIterator iterator = ts_node_iterate_children(&self);
+  while (count < capacity && ts_node_child_iterator_next(&iterator, &child)) {
+    TSFieldId field = 0;
+    if (fields && !ts_subtree_extra(ts_node__subtree(child))) {
+      for (const TSFieldMapEntry *entry = field_map; entry < field_map_end; entry++) {
+        if (!entry->inherited && entry->child_index == iterator.structural_child_index - 1) {
+          field = entry->field_id;
+          break;
+        }
+      }
+      if (!field) field = self_field;
+    }
+
+    if (ts_node__is_relevant(child, true)) {
+      children[count] = child;
+      if (fields) fields[count] = field;
+      count++;
+    } else if (ts_node__relevant_child_count(child, true) > 0) {
+      count = ts_node__children(child, field, children, fields, count, capacity);
+    }
+  }
+  return count;
+}
+
+uint32_t ts_node_children(TSNode self, TSNode *children, TSFieldId *fields, uint32_t capacity) {
+  if (ts_subtree_child_count(ts_node__subtree(self)) == 0) return 0;
+  return ts_node__children(self, 0, children, fields, 0, capacity);
+}
+
+uint32_t ts_node_descendants_for_symbol(
+  TSNode self,
+  TSSymbol symbol,
+  TSNode *nodes,
+  uint32_t capacity
+) {
+  uint32_t count = 0;
+  uint32_t bit = ts_symbol_summary_bit(symbol);
+  Array(NodeChildIterator) stack = array_new();
+  if (ts_subtree_symbol_summary(ts_node__subtree(self)) & bit) {
+    array_push(&stack, ts_node_iterate_children(&self));
+  }
+
+  // Hidden nodes are walked too, so that a hidden repetition whose summary
+  // lacks the symbol is skipped as a whole.
+  while (stack.size > 0) {
+    TSNode child;
+    if (!ts_node_child_iterator_next(array_back(&stack), &child)) {
+      stack.size--;
+      continue;
+    }
+    if (ts_node__is_relevant(child, true) && ts_node_symbol(child) == symbol) {
+      if (count < capacity) nodes[count] = child;
+      count++;
+    }
+    if (ts_subtree_symbol_summary(ts_node__subtree(child)) & bit) {
+      array_push(&stack, ts_node_iterate_children(&child));
+    }
+  }
+  array_delete(&stack);
+  return count;
+}
+
 TSNode ts_node_child_by_field_id(TSNode self, TSFieldId field_id) {
 recur:
   if (!field_id || ts_node_child_count(self) == 0) return ts_node__null();
@@ -1,3 +1,6 @@
+#undef TS_ALLOCATION_SUBSYSTEM
+#define TS_ALLOCATION_SUBSYSTEM TSAllocationSubsystemParser
+
 #include <time.h>
 #include <assert.h>
 #include <stdio.h>
@@ -17,6 +20,7 @@
 #include "./reusable_node.h"
 #include "./stack.h"
 #include "./subtree.h"
+#include "./trace.h"
 #include "./tree.h"
 
 #define LOG(...)                                                                            \
@@ -51,8 +55,28 @@ typedef struct {
   Subtree token;
   Subtree last_external_token;
   uint32_t byte_index;
+} TokenCacheEntry;
+
+// The tokens lexed during the last parse, sorted by position. When the next
+// parse is given the tree that this cache was built for, the edits recorded
+// in that tree are replayed on the cache, so that the tokens around an edit
+// need not be lexed again even where their subtrees can't be reused.
+//
+// An edit moves every token after it, so rather than rewriting them, the
+// entries from `shift_index` on are stored `shift` bytes before their real
+// position. Each edit then only rewrites the entries between its own tail
+// and the previous one.
+typedef struct {
+  Array(TokenCacheEntry) entries;
+  uint32_t hint;
+  uint64_t id;
+  uint32_t shift_index;
+  uint32_t shift;
+  uint32_t max_extent;
 } TokenCache;
 
+static uint64_t ts_parser__token_cache_id_counter = 0;
+
 struct TSParser {
   Lexer lexer;
   Stack *stack;
@@ -71,6 +95,12 @@ struct TSParser {
   unsigned accept_count;
   unsigned operation_count;
   const volatile size_t *cancellation_flag;
+  TSParserLimits limits;
+  TSDuration budget_duration;
+  TSClock budget_clock;
+  uint64_t budget_operation_count;
+  bool is_over_budget;
+  TSParseStats stats;
   Subtree old_tree;
   TSRangeArray included_range_differences;
   unsigned included_range_difference_index;
@@ -135,6 +165,28 @@ static void ts_parser__log(TSParser *self) {
   }
 }
 
+// Once the latency budget of a parse is exceeded, fewer stack versions are
+// kept and error recovery looks less deep into the stack.
+static inline unsigned ts_parser__max_version_count(const TSParser *self) {
+  return self->is_over_budget ? self->limits.budget_version_count : self->limits.max_version_count;
+}
+
+static inline unsigned ts_parser__max_summary_depth(const TSParser *self) {
+  return self->is_over_budget ? self->limits.budget_summary_depth : self->limits.max_summary_depth;
+}
+
+static void ts_parser__check_budget(TSParser *self) {
+  if (self->is_over_budget) return;
+  self->budget_operation_count += OP_COUNT_PER_TIMEOUT_CHECK;
+  if (
+    (self->limits.budget_operations && self->budget_operation_count >= self->limits.budget_operations) ||
+    (!clock_is_null(self->budget_clock) && clock_is_gt(clock_now(), self->budget_clock))
+  ) {
+    self->is_over_budget = true;
+    LOG("over_budget operations:%llu", (unsigned long long)self->budget_operation_count);
+  }
+}
+
 static bool ts_parser__breakdown_top_of_stack(
   TSParser *self,
   StackVersion version
@@ -227,7 +279,7 @@ static ErrorComparison ts_parser__compare_versions(
   }
 
   if (a.cost < b.cost) {
-    if ((b.cost - a.cost) * (1 + a.node_count) > MAX_COST_DIFFERENCE) {
+    if ((b.cost - a.cost) * (1 + a.node_count) > self->limits.max_cost_difference) {
       return ErrorComparisonTakeLeft;
     } else {
       return ErrorComparisonPreferLeft;
@@ -235,7 +287,7 @@ static ErrorComparison ts_parser__compare_versions(
   }
 
   if (b.cost < a.cost) {
-    if ((a.cost - b.cost) * (1 + b.node_count) > MAX_COST_DIFFERENCE) {
+    if ((a.cost - b.cost) * (1 + b.node_count) > self->limits.max_cost_difference) {
       return ErrorComparisonTakeRight;
     } else {
       return ErrorComparisonPreferRight;
@@ -533,9 +585,69 @@ static Subtree ts_parser__lex(
     );
   }
 
+  self->stats.tokens_lexed++;
+  if (lookahead_end_byte > start_position.bytes) {
+    self->stats.bytes_lexed += lookahead_end_byte - start_position.bytes;
+  }
   return result;
 }
 
+static inline uint32_t ts_parser__token_cache_position(const TokenCache *cache, uint32_t index) {
+  uint32_t byte_index = cache->entries.contents[index].byte_index;
+  return index >= cache->shift_index ? byte_index + cache->shift : byte_index;
+}
+
+// Move the start of the shifted entries to the given index.
+static void ts_parser__token_cache_move_shift(TokenCache *cache, uint32_t index) {
+  if (cache->shift == 0) {
+    cache->shift_index = index;
+    return;
+  }
+  for (uint32_t i = index; i < cache->shift_index; i++) {
+    cache->entries.contents[i].byte_index -= cache->shift;
+  }
+  for (uint32_t i = cache->shift_index; i < index; i++) {
+    cache->entries.contents[i].byte_index += cache->shift;
+  }
+  cache->shift_index = index;
+}
+
+// Find the index of the first cached token at or after the given position.
+// The parser mostly asks for the position after the last token it found, so
+// check there before bisecting.
+static uint32_t ts_parser__token_cache_search(TokenCache *cache, uint32_t byte_index) {
+  uint32_t size = cache->entries.size;
+  uint32_t hint = cache->hint;
+  for (uint32_t i = hint; i < size && i < hint + 2; i++) {
+    if (
+      ts_parser__token_cache_position(cache, i) >= byte_index &&
+      (i == 0 || ts_parser__token_cache_position(cache, i - 1) < byte_index)
+    ) {
+      cache->hint = i;
+      return i;
+    }
+  }
+
+  uint32_t low = 0, high = size;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (ts_parser__token_cache_position(cache, mid) < byte_index) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  cache->hint = low;
+  return low;
+}
+
+static void ts_parser__release_cached_token(TSParser *self, TokenCacheEntry *entry) {
+  ts_subtree_release(&self->tree_pool, entry->token);
+  if (entry->last_external_token.ptr) {
+    ts_subtree_release(&self->tree_pool, entry->last_external_token);
+  }
+}
+
 static Subtree ts_parser__get_cached_token(
   TSParser *self,
   TSStateId state,
@@ -544,14 +656,19 @@ static Subtree ts_parser__get_cached_token(
   TableEntry *table_entry
 ) {
   TokenCache *cache = &self->token_cache;
+  uint32_t index = ts_parser__token_cache_search(cache, position);
+  if (index == cache->entries.size) return NULL_SUBTREE;
+
+  TokenCacheEntry *entry = &cache->entries.contents[index];
   if (
-    cache->token.ptr && cache->byte_index == position &&
-    ts_subtree_external_scanner_state_eq(cache->last_external_token, last_external_token)
+    ts_parser__token_cache_position(cache, index) == position &&
+    ts_subtree_external_scanner_state_eq(entry->last_external_token, last_external_token)
   ) {
-    ts_language_table_entry(self->language, state, ts_subtree_symbol(cache->token), table_entry);
-    if (ts_parser__can_reuse_first_leaf(self, state, cache->token, table_entry)) {
-      ts_subtree_retain(cache->token);
-      return cache->token;
+    ts_language_table_entry(self->language, state, ts_subtree_symbol(entry->token), table_entry);
+    if (ts_parser__can_reuse_first_leaf(self, state, entry->token, table_entry)) {
+      self->stats.tokens_from_cache++;
+      ts_subtree_retain(entry->token);
+      return entry->token;
     }
   }
   return NULL_SUBTREE;
@@ -564,13 +681,88 @@ static void ts_parser__set_cached_token(
   Subtree token
 ) {
   TokenCache *cache = &self->token_cache;
-  if (token.ptr) ts_subtree_retain(token);
+  TokenCacheEntry entry = {token, last_external_token, byte_index};
+  ts_subtree_retain(token);
   if (last_external_token.ptr) ts_subtree_retain(last_external_token);
-  if (cache->token.ptr) ts_subtree_release(&self->tree_pool, cache->token);
-  if (cache->last_external_token.ptr) ts_subtree_release(&self->tree_pool, cache->last_external_token);
-  cache->token = token;
-  cache->byte_index = byte_index;
-  cache->last_external_token = last_external_token;
+
+  // Only the latest token lexed at each position is kept. Lexing mostly moves
+  // forward, so this is usually an append.
+  uint32_t index = ts_parser__token_cache_search(cache, byte_index);
+  if (index >= cache->shift_index) entry.byte_index -= cache->shift;
+  if (index < cache->entries.size && ts_parser__token_cache_position(cache, index) == byte_index) {
+    ts_parser__release_cached_token(self, &cache->entries.contents[index]);
+    cache->entries.contents[index] = entry;
+  } else {
+    array_insert(&cache->entries, index, entry);
+    if (index < cache->shift_index) cache->shift_index++;
+  }
+
+  uint32_t extent = ts_subtree_total_bytes(token) + ts_subtree_lookahead_bytes(token);
+  if (extent > cache->max_extent) cache->max_extent = extent;
+}
+
+static void ts_parser__clear_token_cache(TSParser *self) {
+  TokenCache *cache = &self->token_cache;
+  for (uint32_t i = 0; i < cache->entries.size; i++) {
+    ts_parser__release_cached_token(self, &cache->entries.contents[i]);
+  }
+  array_clear(&cache->entries);
+  cache->hint = 0;
+  cache->id = 0;
+  cache->shift_index = 0;
+  cache->shift = 0;
+  cache->max_extent = 0;
+}
+
+// Drop the cached tokens whose text, or the text the lexer looked at past
+// them, overlaps the edit, and shift the tokens after it. No token starting
+// more than `max_extent` bytes before the edit can reach it, so only the
+// tokens from there up to the end of the edit are looked at.
+static void ts_parser__edit_token_cache(TSParser *self, const TSInputEdit *edit) {
+  TokenCache *cache = &self->token_cache;
+  uint32_t reach_byte = edit->start_byte > cache->max_extent
+    ? edit->start_byte - cache->max_extent
+    : 0;
+  uint32_t start = ts_parser__token_cache_search(cache, reach_byte);
+  uint32_t end = ts_parser__token_cache_search(cache, edit->old_end_byte + 1);
+  ts_parser__token_cache_move_shift(cache, start);
+
+  uint32_t kept = start;
+  for (uint32_t i = start; i < end; i++) {
+    TokenCacheEntry entry = cache->entries.contents[i];
+    entry.byte_index += cache->shift;
+    uint32_t end_byte =
+      entry.byte_index +
+      ts_subtree_total_bytes(entry.token) +
+      ts_subtree_lookahead_bytes(entry.token);
+    if (end_byte < edit->start_byte) {
+      cache->entries.contents[kept++] = entry;
+    } else {
+      ts_parser__release_cached_token(self, &entry);
+    }
+  }
+  array_splice(&cache->entries, kept, end - kept, 0, NULL);
+  cache->shift_index = kept;
+  cache->shift += edit->new_end_byte - edit->old_end_byte;
+  cache->hint = 0;
+}
+
+// Keep the cached tokens for a parse of the given old tree only if they were
+// lexed from that tree's text, and every edit since then is known.
+static void ts_parser__restore_token_cache(TSParser *self, const TSTree *old_tree) {
+  if (
+    !old_tree ||
+    !self->token_cache.id ||
+    old_tree->token_cache_id != self->token_cache.id ||
+    self->included_range_differences.size > 0
+  ) {
+    ts_parser__clear_token_cache(self);
+    return;
+  }
+  for (uint32_t i = 0; i < old_tree->edit_count; i++) {
+    ts_parser__edit_token_cache(self, &old_tree->edits[i]);
+  }
+  self->token_cache.id = 0;
 }
 
 static bool ts_parser__has_included_range_difference(
@@ -658,6 +850,9 @@ static Subtree ts_parser__reuse_node(
     }
 
     LOG("reuse_node symbol:%s", TREE_NAME(result));
+    self->stats.subtrees_reused++;
+    self->stats.nodes_reused += ts_subtree_node_count(result);
+    self->stats.bytes_reused += ts_subtree_total_bytes(result);
     ts_subtree_retain(result);
     return result;
   }
@@ -772,7 +967,7 @@ static StackVersion ts_parser__reduce(
     // Error recovery can sometimes cause lots of stack versions to merge,
     // such that a single pop operation can produce a lots of slices.
     // Avoid creating too many stack versions in that situation.
-    if (i > 0 && slice_version > MAX_VERSION_COUNT + MAX_VERSION_COUNT_OVERFLOW) {
+    if (i > 0 && slice_version > ts_parser__max_version_count(self) + MAX_VERSION_COUNT_OVERFLOW) {
       ts_stack_remove_version(self->stack, slice_version);
       ts_subtree_array_delete(&self->tree_pool, &slice.subtrees);
       removed_version_count++;
@@ -796,6 +991,7 @@ static StackVersion ts_parser__reduce(
     MutableSubtree parent = ts_subtree_new_node(&self->tree_pool,
       symbol, &children, production_id, self->language
     );
+    self->stats.nodes_created++;
 
     // This pop operation may have caused multiple stack versions to collapse
     // into one, because they all diverged from a common state. In that case,
@@ -980,7 +1176,7 @@ static bool ts_parser__do_all_potential_reductions(
 
     if (has_shift_action) {
       can_shift_lookahead_symbol = true;
-    } else if (reduction_version != STACK_VERSION_NONE && i < MAX_VERSION_COUNT) {
+    } else if (reduction_version != STACK_VERSION_NONE && i < ts_parser__max_version_count(self)) {
       ts_stack_renumber_version(self->stack, reduction_version, version);
       continue;
     } else if (lookahead_symbol != 0) {
@@ -1003,6 +1199,7 @@ static void ts_parser__handle_error(
   TSSymbol lookahead_symbol
 ) {
   uint32_t previous_version_count = ts_stack_version_count(self->stack);
+  self->stats.error_count++;
 
   // Perform any reductions that can happen in this state, regardless of the lookahead. After
   // skipping one or more invalid tokens, the parser might find a token that would have allowed
@@ -1074,7 +1271,7 @@ static void ts_parser__handle_error(
     assert(did_merge);
   }
 
-  ts_stack_record_summary(self->stack, version, MAX_SUMMARY_DEPTH);
+  ts_stack_record_summary(self->stack, version, ts_parser__max_summary_depth(self));
   LOG_STACK();
 }
 
@@ -1121,6 +1318,7 @@ static bool ts_parser__recover_to_state(
 
     if (slice.subtrees.size > 0) {
       Subtree error = ts_subtree_new_error_node(&self->tree_pool, &slice.subtrees, true, self->language);
+      self->stats.nodes_created++;
       ts_stack_push(self->stack, slice.version, error, false, goal_state);
     } else {
       array_delete(&slice.subtrees);
@@ -1145,6 +1343,7 @@ static void ts_parser__recover(
 ) {
   bool did_recover = false;
   unsigned previous_version_count = ts_stack_version_count(self->stack);
+  self->stats.recover_count++;
   Length position = ts_stack_position(self->stack, version);
   StackSummary *summary = ts_stack_get_summary(self->stack, version);
   unsigned node_count_since_error = ts_stack_node_count_since_error(self->stack, version);
@@ -1218,7 +1417,7 @@ static void ts_parser__recover(
   // current lookahead token by wrapping it in an ERROR node.
 
   // Don't pursue this additional strategy if there are already too many stack versions.
-  if (did_recover && ts_stack_version_count(self->stack) > MAX_VERSION_COUNT) {
+  if (did_recover && ts_stack_version_count(self->stack) > ts_parser__max_version_count(self)) {
     ts_stack_halt(self->stack, version);
     ts_subtree_release(&self->tree_pool, lookahead);
     return;
@@ -1230,6 +1429,7 @@ static void ts_parser__recover(
     LOG("recover_eof");
     SubtreeArray children = array_new();
     Subtree parent = ts_subtree_new_error_node(&self->tree_pool, &children, false, self->language);
+    self->stats.nodes_created++;
     ts_stack_push(self->stack, version, parent, false, 1);
     ts_parser__accept(self, version, lookahead);
     return;
@@ -1268,6 +1468,7 @@ static void ts_parser__recover(
     0,
     self->language
   );
+  self->stats.nodes_created++;
 
   // If other tokens have already been skipped, so there is already an ERROR at the top of the
   // stack, then pop that ERROR off the stack and wrap the two ERRORs together into one larger
@@ -1297,6 +1498,7 @@ static void ts_parser__recover(
       0,
       self->language
     );
+    self->stats.nodes_created++;
   }
 
   // Push the new ERROR onto the stack.
@@ -1359,13 +1561,15 @@ static bool ts_parser__advance(
     if (++self->operation_count == OP_COUNT_PER_TIMEOUT_CHECK) {
       self->operation_count = 0;
     }
-    if (
-      self->operation_count == 0 &&
-      ((self->cancellation_flag && atomic_load(self->cancellation_flag)) ||
-       (!clock_is_null(self->end_clock) && clock_is_gt(clock_now(), self->end_clock)))
-    ) {
-      ts_subtree_release(&self->tree_pool, lookahead);
-      return false;
+    if (self->operation_count == 0) {
+      if (
+        (self->cancellation_flag && atomic_load(self->cancellation_flag)) ||
+        (!clock_is_null(self->end_clock) && clock_is_gt(clock_now(), self->end_clock))
+      ) {
+        ts_subtree_release(&self->tree_pool, lookahead);
+        return false;
+      }
+      ts_parser__check_budget(self);
     }
 
     // Process each parse action for the current lookahead token in
@@ -1576,8 +1780,9 @@ static unsigned ts_parser__condense_stack(TSParser *self) {
 
   // Enfore a hard upper bound on the number of stack versions by
   // discarding the least promising versions.
-  while (ts_stack_version_count(self->stack) > MAX_VERSION_COUNT) {
-    ts_stack_remove_version(self->stack, MAX_VERSION_COUNT);
+  unsigned max_version_count = ts_parser__max_version_count(self);
+  while (ts_stack_version_count(self->stack) > max_version_count) {
+    ts_stack_remove_version(self->stack, max_version_count);
     made_changes = true;
   }
 
@@ -1588,7 +1793,7 @@ static unsigned ts_parser__condense_stack(TSParser *self) {
     bool has_unpaused_version = false;
     for (StackVersion i = 0, n = ts_stack_version_count(self->stack); i < n; i++) {
       if (ts_stack_is_paused(self->stack, i)) {
-        if (!has_unpaused_version && self->accept_count < MAX_VERSION_COUNT) {
+        if (!has_unpaused_version && self->accept_count < max_version_count) {
           LOG("resume version:%u", i);
           min_error_cost = ts_stack_error_cost(self->stack, i);
           TSSymbol lookahead_symbol = ts_stack_resume(self->stack, i);
@@ -1636,11 +1841,22 @@ TSParser *ts_parser_new(void) {
   self->timeout_duration = 0;
   self->end_clock = clock_null();
   self->operation_count = 0;
+  self->limits = ts_parser_default_limits();
+  self->budget_duration = 0;
+  self->budget_clock = clock_null();
+  self->budget_operation_count = 0;
+  self->is_over_budget = false;
+  self->stats = (TSParseStats) {0};
   self->old_tree = NULL_SUBTREE;
   self->scratch_tree.ptr = &self->scratch_tree_data;
   self->included_range_differences = (TSRangeArray) array_new();
   self->included_range_difference_index = 0;
-  ts_parser__set_cached_token(self, 0, NULL_SUBTREE, NULL_SUBTREE);
+  array_init(&self->token_cache.entries);
+  self->token_cache.hint = 0;
+  self->token_cache.id = 0;
+  self->token_cache.shift_index = 0;
+  self->token_cache.shift = 0;
+  self->token_cache.max_extent = 0;
   return self;
 }
 
@@ -1660,7 +1876,8 @@ void ts_parser_delete(TSParser *self) {
     self->old_tree = NULL_SUBTREE;
   }
   ts_lexer_delete(&self->lexer);
-  ts_parser__set_cached_token(self, 0, NULL_SUBTREE, NULL_SUBTREE);
+  ts_parser__clear_token_cache(self);
+  array_delete(&self->token_cache.entries);
   ts_subtree_pool_delete(&self->tree_pool);
   reusable_node_delete(&self->reusable_node);
   ts_free(self);
@@ -1727,6 +1944,46 @@ void ts_parser_set_timeout_micros(TSParser *self, uint64_t timeout_micros) {
   self->timeout_duration = duration_from_micros(timeout_micros);
 }
 
+TSParserLimits ts_parser_default_limits(void) {
+  return (TSParserLimits) {
+    .max_version_count = MAX_VERSION_COUNT,
+    .max_cost_difference = MAX_COST_DIFFERENCE,
+    .max_summary_depth = MAX_SUMMARY_DEPTH,
+    .max_node_pool_size = STACK_DEFAULT_NODE_POOL_SIZE,
+    .max_link_count = STACK_MAX_LINK_COUNT,
+    .budget_micros = 0,
+    .budget_operations = 0,
+    .budget_version_count = 1,
+    .budget_summary_depth = 2,
+  };
+}
+
+void ts_parser_set_limits(TSParser *self, const TSParserLimits *limits) {
+  self->limits = limits ? *limits : ts_parser_default_limits();
+  if (self->limits.max_version_count < 1) self->limits.max_version_count = 1;
+  if (self->limits.budget_version_count < 1) self->limits.budget_version_count = 1;
+  if (self->limits.budget_version_count > self->limits.max_version_count) {
+    self->limits.budget_version_count = self->limits.max_version_count;
+  }
+  if (self->limits.budget_summary_depth > self->limits.max_summary_depth) {
+    self->limits.budget_summary_depth = self->limits.max_summary_depth;
+  }
+  if (self->limits.max_link_count < 1) self->limits.max_link_count = 1;
+  if (self->limits.max_link_count > STACK_MAX_LINK_COUNT) {
+    self->limits.max_link_count = STACK_MAX_LINK_COUNT;
+  }
+  self->budget_duration = duration_from_micros(self->limits.budget_micros);
+  ts_stack_set_limits(self->stack, self->limits.max_node_pool_size, self->limits.max_link_count);
+}
+
+TSParserLimits ts_parser_limits(const TSParser *self) {
+  return self->limits;
+}
+
+TSParseStats ts_parser_stats(const TSParser *self) {
+  return self->stats;
+}
+
 bool ts_parser_set_included_ranges(
   TSParser *self,
   const TSRange *ranges,
@@ -1739,7 +1996,9 @@ const TSRange *ts_parser_included_ranges(const TSParser *self, uint32_t *count)
   return ts_lexer_included_ranges(&self->lexer, count);
 }
 
-void ts_parser_reset(TSParser *self) {
+// Discard the state of an outstanding parse, but keep the token cache for
+// the next parse of the tree that was just produced.
+static void ts_parser__reset(TSParser *self) {
   if (self->language && self->language->external_scanner.deserialize) {
     self->language->external_scanner.deserialize(self->external_scanner_payload, NULL, 0);
   }
@@ -1752,12 +2011,18 @@ void ts_parser_reset(TSParser *self) {
   reusable_node_clear(&self->reusable_node);
   ts_lexer_reset(&self->lexer, length_zero());
   ts_stack_clear(self->stack);
-  ts_parser__set_cached_token(self, 0, NULL_SUBTREE, NULL_SUBTREE);
   if (self->finished_tree.ptr) {
     ts_subtree_release(&self->tree_pool, self->finished_tree);
     self->finished_tree = NULL_SUBTREE;
   }
   self->accept_count = 0;
+  self->budget_operation_count = 0;
+  self->is_over_budget = false;
+}
+
+void ts_parser_reset(TSParser *self) {
+  ts_parser__reset(self);
+  ts_parser__clear_token_cache(self);
 }
 
 TSTree *ts_parser_parse(
@@ -1767,11 +2032,18 @@ TSTree *ts_parser_parse(
 ) {
   if (!self->language || !input.read) return NULL;
 
+  TS_TRACE_BEGIN(total);
+  TS_TRACE_BEGIN(setup);
+  TSClock start_clock = clock_now();
   ts_lexer_set_input(&self->lexer, input);
 
   array_clear(&self->included_range_differences);
   self->included_range_difference_index = 0;
 
+  if (!ts_parser_has_outstanding_parse(self)) {
+    self->stats = (TSParseStats) {0};
+  }
+
   if (ts_parser_has_outstanding_parse(self)) {
     LOG("resume_parsing");
   } else if (old_tree) {
@@ -1789,7 +2061,9 @@ TSTree *ts_parser_parse(
       TSRange *range = &self->included_range_differences.contents[i];
       LOG("different_included_range %u - %u", range->start_byte, range->end_byte);
     }
+    ts_parser__restore_token_cache(self, old_tree);
   } else {
+    ts_parser__clear_token_cache(self);
     reusable_node_clear(&self->reusable_node);
     LOG("new_parse");
   }
@@ -1801,12 +2075,25 @@ TSTree *ts_parser_parse(
   } else {
     self->end_clock = clock_null();
   }
+  if (self->budget_duration) {
+    self->budget_clock = clock_after(clock_now(), self->budget_duration);
+  } else {
+    self->budget_clock = clock_null();
+  }
+
+  TSClock parse_clock = clock_now();
+  self->stats.setup_micros += duration_to_micros(clock_elapsed(start_clock, parse_clock));
+  TS_TRACE_END(setup, "ts_parser_parse setup");
+  TS_TRACE_BEGIN(loop);
 
   do {
     for (StackVersion version = 0;
          version_count = ts_stack_version_count(self->stack), version < version_count;
          version++) {
       bool allow_node_reuse = version_count == 1;
+      if (version_count > self->stats.max_version_count) {
+        self->stats.max_version_count = version_count;
+      }
       while (ts_stack_is_active(self->stack, version)) {
         LOG("process version:%d, version_count:%u, state:%d, row:%u, col:%u",
             version, ts_stack_version_count(self->stack),
@@ -1814,7 +2101,15 @@ TSTree *ts_parser_parse(
             ts_stack_position(self->stack, version).extent.row + 1,
             ts_stack_position(self->stack, version).extent.column);
 
-        if (!ts_parser__advance(self, version, allow_node_reuse)) return NULL;
+        if (!ts_parser__advance(self, version, allow_node_reuse)) {
+          TSClock halt_clock = clock_now();
+          self->stats.parse_micros += duration_to_micros(clock_elapsed(parse_clock, halt_clock));
+          self->stats.total_micros += duration_to_micros(clock_elapsed(start_clock, halt_clock));
+          self->stats.over_budget = self->is_over_budget;
+          TS_TRACE_END(loop, "ts_parser_parse loop");
+          TS_TRACE_END(total, "ts_parser_parse");
+          return NULL;
+        }
         LOG_STACK();
 
         position = ts_stack_position(self->stack, version).bytes;
@@ -1826,6 +2121,7 @@ TSTree *ts_parser_parse(
     }
 
     unsigned min_error_cost = ts_parser__condense_stack(self);
+    self->stats.condense_count++;
     if (self->finished_tree.ptr && ts_subtree_error_cost(self->finished_tree) < min_error_cost) {
       break;
     }
@@ -1840,6 +2136,10 @@ TSTree *ts_parser_parse(
     }
   } while (version_count != 0);
 
+  TSClock balance_clock = clock_now();
+  self->stats.parse_micros += duration_to_micros(clock_elapsed(parse_clock, balance_clock));
+  TS_TRACE_END(loop, "ts_parser_parse loop");
+  TS_TRACE_BEGIN(balance);
   ts_subtree_balance(self->finished_tree, &self->tree_pool, self->language);
   LOG("done");
   LOG_TREE(self->finished_tree);
@@ -1851,7 +2151,16 @@ TSTree *ts_parser_parse(
     self->lexer.included_range_count
   );
   self->finished_tree = NULL_SUBTREE;
-  ts_parser_reset(self);
+  self->token_cache.id = atomic_add64(&ts_parser__token_cache_id_counter, 1);
+  result->token_cache_id = self->token_cache.id;
+
+  TSClock end_clock = clock_now();
+  self->stats.balance_micros += duration_to_micros(clock_elapsed(balance_clock, end_clock));
+  self->stats.total_micros += duration_to_micros(clock_elapsed(start_clock, end_clock));
+  self->stats.over_budget = self->is_over_budget;
+  ts_parser__reset(self);
+  TS_TRACE_END(balance, "ts_parser_parse balance");
+  TS_TRACE_END(total, "ts_parser_parse");
   return result;
 }
 
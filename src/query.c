@@ -1,9 +1,13 @@
+#undef TS_ALLOCATION_SUBSYSTEM
+#define TS_ALLOCATION_SUBSYSTEM TSAllocationSubsystemQuery
+
 #include "tree_sitter/api.h"
 #include "./alloc.h"
 #include "./array.h"
 #include "./bits.h"
 #include "./language.h"
 #include "./point.h"
+#include "./trace.h"
 #include "./tree_cursor.h"
 #include "./unicode.h"
 #include <wctype.h>
@@ -98,7 +102,7 @@ typedef struct {
   uint16_t consumed_capture_count;
   uint16_t repeat_match_count;
   uint16_t step_index_on_failure;
-  uint8_t capture_list_id;
+  uint16_t capture_list_id;
   bool seeking_non_match;
 } QueryState;
 
@@ -107,12 +111,13 @@ typedef Array(TSQueryCapture) CaptureList;
 /*
  * CaptureListPool - A collection of *lists* of captures. Each QueryState
  * needs to maintain its own list of captures. To avoid repeated allocations,
- * the reuses a fixed set of capture lists, and keeps track of which ones
- * are currently in use.
+ * the pool reuses the capture lists it has allocated, and keeps a stack of
+ * the ones that are currently free. It grows up to `max_list_count` lists.
  */
 typedef struct {
-  CaptureList list[32];
-  uint32_t usage_map;
+  Array(CaptureList) list;
+  Array(uint16_t) free_ids;
+  uint16_t max_list_count;
 } CaptureListPool;
 
 /*
@@ -130,6 +135,7 @@ struct TSQuery {
   Array(uint32_t) start_bytes_by_pattern;
   const TSLanguage *language;
   uint16_t wildcard_root_pattern_count;
+  uint32_t root_symbol_summary;
   TSSymbol *symbol_map;
 };
 
@@ -148,6 +154,8 @@ struct TSQueryCursor {
   uint32_t next_state_id;
   TSPoint start_point;
   TSPoint end_point;
+  uint32_t match_limit;
+  uint32_t overflow_count;
   bool ascending;
 };
 
@@ -157,6 +165,7 @@ static const uint16_t NONE = UINT16_MAX;
 static const TSSymbol WILDCARD_SYMBOL = 0;
 static const TSSymbol NAMED_WILDCARD_SYMBOL = UINT16_MAX - 1;
 static const uint16_t MAX_STATE_COUNT = 32;
+static const uint16_t MAX_CAPTURE_LIST_COUNT = UINT16_MAX - 1;
 
 // #define LOG(...) fprintf(stderr, __VA_ARGS__)
 #define LOG(...)
@@ -242,45 +251,52 @@ static void stream_scan_identifier(Stream *stream) {
 
 static CaptureListPool capture_list_pool_new() {
   return (CaptureListPool) {
-    .usage_map = UINT32_MAX,
+    .list = array_new(),
+    .free_ids = array_new(),
+    .max_list_count = MAX_CAPTURE_LIST_COUNT,
   };
 }
 
-static void capture_list_pool_reset(CaptureListPool *self) {
-  self->usage_map = UINT32_MAX;
-  for (unsigned i = 0; i < 32; i++) {
-    array_clear(&self->list[i]);
+// Free every list, and drop the ones beyond the maximum count.
+static void capture_list_pool_reset(CaptureListPool *self, uint16_t max_list_count) {
+  while (self->list.size > max_list_count) {
+    array_delete(array_back(&self->list));
+    self->list.size--;
+  }
+  self->max_list_count = max_list_count;
+  array_clear(&self->free_ids);
+  for (uint32_t i = self->list.size; i > 0; i--) {
+    array_clear(&self->list.contents[i - 1]);
+    array_push(&self->free_ids, i - 1);
   }
 }
 
 static void capture_list_pool_delete(CaptureListPool *self) {
-  for (unsigned i = 0; i < 32; i++) {
-    array_delete(&self->list[i]);
+  for (unsigned i = 0; i < self->list.size; i++) {
+    array_delete(&self->list.contents[i]);
   }
+  array_delete(&self->list);
+  array_delete(&self->free_ids);
 }
 
 static CaptureList *capture_list_pool_get(CaptureListPool *self, uint16_t id) {
-  return &self->list[id];
+  return &self->list.contents[id];
 }
 
 static bool capture_list_pool_is_empty(const CaptureListPool *self) {
-  return self->usage_map == 0;
+  return self->free_ids.size == 0 && self->list.size >= self->max_list_count;
 }
 
 static uint16_t capture_list_pool_acquire(CaptureListPool *self) {
-  // In the usage_map bitmask, ones represent free lists, and zeros represent
-  // lists that are in use. A free list id can quickly be found by counting
-  // the leading zeros in the usage map. An id of zero corresponds to the
-  // highest-order bit in the bitmask.
-  uint16_t id = count_leading_zeros(self->usage_map);
-  if (id == 32) return NONE;
-  self->usage_map &= ~bitmask_for_index(id);
-  return id;
+  if (self->free_ids.size > 0) return array_pop(&self->free_ids);
+  if (self->list.size >= self->max_list_count) return NONE;
+  array_push(&self->list, ((CaptureList) array_new()));
+  return self->list.size - 1;
 }
 
 static void capture_list_pool_release(CaptureListPool *self, uint16_t id) {
-  array_clear(&self->list[id]);
-  self->usage_map |= bitmask_for_index(id);
+  array_clear(&self->list.contents[id]);
+  array_push(&self->free_ids, id);
 }
 
 /**************
@@ -943,6 +959,7 @@ TSQuery *ts_query_new(
     .predicates_by_pattern = array_new(),
     .symbol_map = symbol_map,
     .wildcard_root_pattern_count = 0,
+    .root_symbol_summary = 0,
     .language = language,
   };
 
@@ -989,6 +1006,18 @@ TSQuery *ts_query_new(
     if (self->steps.contents[start_step_index].symbol == WILDCARD_SYMBOL) {
       self->wildcard_root_pattern_count++;
     }
+
+    // Subtrees whose symbol summary has none of these bits start no pattern.
+    // The summary holds public symbols, which the old symbol map doesn't.
+    if (
+      self->steps.contents[start_step_index].symbol == WILDCARD_SYMBOL ||
+      self->symbol_map
+    ) {
+      self->root_symbol_summary = UINT32_MAX;
+    } else {
+      self->root_symbol_summary |=
+        ts_symbol_summary_bit(self->steps.contents[start_step_index].symbol);
+    }
   }
 
   ts_query__finalize_steps(self);
@@ -1009,6 +1038,34 @@ void ts_query_delete(TSQuery *self) {
   }
 }
 
+#define ts_query__copy_array(self, other)                     \
+  do {                                                        \
+    array_init(self);                                         \
+    if ((other)->size) array_splice(                          \
+      (self), 0, 0, (other)->size, (other)->contents          \
+    );                                                        \
+  } while (0)
+
+TSQuery *ts_query_copy(const TSQuery *self) {
+  TSQuery *result = ts_malloc(sizeof(TSQuery));
+  *result = *self;
+  ts_query__copy_array(&result->captures.characters, &self->captures.characters);
+  ts_query__copy_array(&result->captures.slices, &self->captures.slices);
+  ts_query__copy_array(&result->predicate_values.characters, &self->predicate_values.characters);
+  ts_query__copy_array(&result->predicate_values.slices, &self->predicate_values.slices);
+  ts_query__copy_array(&result->steps, &self->steps);
+  ts_query__copy_array(&result->pattern_map, &self->pattern_map);
+  ts_query__copy_array(&result->predicate_steps, &self->predicate_steps);
+  ts_query__copy_array(&result->predicates_by_pattern, &self->predicates_by_pattern);
+  ts_query__copy_array(&result->start_bytes_by_pattern, &self->start_bytes_by_pattern);
+  if (self->symbol_map) {
+    size_t size = ts_language_symbol_count(self->language) * sizeof(TSSymbol);
+    result->symbol_map = ts_malloc(size);
+    memcpy(result->symbol_map, self->symbol_map, size);
+  }
+  return result;
+}
+
 uint32_t ts_query_pattern_count(const TSQuery *self) {
   return self->predicates_by_pattern.size;
 }
@@ -1054,6 +1111,26 @@ uint32_t ts_query_start_byte_for_pattern(
   return self->start_bytes_by_pattern.contents[pattern_index];
 }
 
+uint32_t ts_query_max_depth_for_symbol(const TSQuery *self, TSSymbol symbol) {
+  if (symbol != ts_builtin_sym_error && self->symbol_map) {
+    symbol = self->symbol_map[symbol];
+  }
+  uint32_t result = UINT32_MAX;
+  for (unsigned i = 0; i < self->steps.size; i++) {
+    QueryStep *step = &self->steps.contents[i];
+    if (step->depth == PATTERN_DONE_MARKER) continue;
+    if (
+      step->symbol != symbol &&
+      step->symbol != WILDCARD_SYMBOL &&
+      step->symbol != NAMED_WILDCARD_SYMBOL
+    ) continue;
+    if (result == UINT32_MAX || step->depth > result) {
+      result = step->depth;
+    }
+  }
+  return result;
+}
+
 void ts_query_disable_capture(
   TSQuery *self,
   const char *name,
@@ -1086,6 +1163,271 @@ void ts_query_disable_pattern(
   }
 }
 
+/***************
+ * QueryBlob
+ ***************/
+
+/*
+ * QueryBlob - The compiled form of a query, written after this header. The
+ * arrays of the query follow one another, each as its size and contents. The
+ * steps are copied as they are in memory, so a blob is only read back by the
+ * same build of the library, and only for a language with the same symbols
+ * and fields as the one it was compiled for.
+ */
+typedef struct {
+  uint32_t magic;
+  uint16_t format_version;
+  uint16_t step_size;
+  uint32_t length;
+  uint32_t checksum;
+  uint32_t language_version;
+  uint32_t language_hash;
+  uint32_t root_symbol_summary;
+  uint16_t wildcard_root_pattern_count;
+  uint16_t has_symbol_map;
+} QueryBlobHeader;
+
+typedef struct {
+  char *contents;
+  uint32_t size;
+} BlobWriter;
+
+typedef struct {
+  const char *input;
+  const char *end;
+} BlobReader;
+
+static const uint32_t QUERY_BLOB_MAGIC = 0x42515354;
+static const uint16_t QUERY_BLOB_FORMAT_VERSION = 1;
+
+static const uint64_t BLOB_HASH_SEED = 0xcbf29ce484222325;
+
+// FNV-1a over 64 bit words, folded after each word so that every bit of the
+// input reaches the low bits that the checksum keeps.
+static uint64_t blob_hash(uint64_t hash, const void *data, size_t length) {
+  const uint8_t *bytes = data;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, &bytes[i], sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3;
+    hash ^= hash >> 32;
+  }
+  for (; i < length; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3;
+  }
+  return hash ^ (hash >> 32);
+}
+
+// A hash of what the steps of a query refer to in its language: the symbol
+// names and types, their public symbols and the field names.
+static uint32_t ts_query__language_hash(const TSLanguage *language) {
+  uint64_t hash = BLOB_HASH_SEED;
+  uint32_t symbol_count = ts_language_symbol_count(language);
+  uint32_t field_count = ts_language_field_count(language);
+  hash = blob_hash(hash, &symbol_count, sizeof(symbol_count));
+  hash = blob_hash(hash, &field_count, sizeof(field_count));
+  for (TSSymbol i = 0; i < symbol_count; i++) {
+    const char *name = ts_language_symbol_name(language, i);
+    uint8_t type = ts_language_symbol_type(language, i);
+    TSSymbol public_symbol = ts_language_public_symbol(language, i);
+    uint32_t info = (uint32_t)type << 16 | public_symbol;
+    hash = blob_hash(hash, name, strlen(name) + 1);
+    hash = blob_hash(hash, &info, sizeof(info));
+  }
+  for (TSFieldId i = 1; i <= field_count; i++) {
+    const char *name = ts_language_field_name_for_id(language, i);
+    hash = blob_hash(hash, name, strlen(name) + 1);
+  }
+  return (uint32_t)hash;
+}
+
+// Without contents, the writer only counts the bytes.
+static void blob_writer_write(BlobWriter *self, const void *data, uint32_t length) {
+  if (self->contents && length) {
+    memcpy(&self->contents[self->size], data, length);
+  }
+  self->size += length;
+}
+
+#define blob_writer_write_array(self, array)                                 \
+  do {                                                                       \
+    blob_writer_write((self), &(array)->size, sizeof(uint32_t));             \
+    blob_writer_write((self), (array)->contents,                             \
+                      (array)->size * array__elem_size(array));              \
+  } while (0)
+
+static bool blob_reader_read(BlobReader *self, void *data, uint32_t length) {
+  if ((size_t)(self->end - self->input) < length) return false;
+  if (length) memcpy(data, self->input, length);
+  self->input += length;
+  return true;
+}
+
+static bool blob_reader_read_array(BlobReader *self, VoidArray *array, size_t element_size) {
+  uint32_t size;
+  if (!blob_reader_read(self, &size, sizeof(size))) return false;
+  if ((size_t)(self->end - self->input) / element_size < size) return false;
+  array__reserve(array, element_size, size, TS_ALLOCATION_SUBSYSTEM);
+  array->size = size;
+  return blob_reader_read(self, array->contents, size * element_size);
+}
+
+#define blob_reader_read_array(self, array) \
+  blob_reader_read_array((self), (VoidArray *)(array), array__elem_size(array))
+
+static void ts_query__write(const TSQuery *self, BlobWriter *writer) {
+  blob_writer_write_array(writer, &self->captures.characters);
+  blob_writer_write_array(writer, &self->captures.slices);
+  blob_writer_write_array(writer, &self->predicate_values.characters);
+  blob_writer_write_array(writer, &self->predicate_values.slices);
+  blob_writer_write_array(writer, &self->steps);
+  blob_writer_write_array(writer, &self->pattern_map);
+  blob_writer_write_array(writer, &self->predicate_steps);
+  blob_writer_write_array(writer, &self->predicates_by_pattern);
+  blob_writer_write_array(writer, &self->start_bytes_by_pattern);
+  if (self->symbol_map) {
+    uint32_t symbol_count = ts_language_symbol_count(self->language);
+    blob_writer_write(writer, self->symbol_map, symbol_count * sizeof(TSSymbol));
+  }
+}
+
+static bool ts_query__read(TSQuery *self, BlobReader *reader, bool has_symbol_map) {
+  if (
+    !blob_reader_read_array(reader, &self->captures.characters) ||
+    !blob_reader_read_array(reader, &self->captures.slices) ||
+    !blob_reader_read_array(reader, &self->predicate_values.characters) ||
+    !blob_reader_read_array(reader, &self->predicate_values.slices) ||
+    !blob_reader_read_array(reader, &self->steps) ||
+    !blob_reader_read_array(reader, &self->pattern_map) ||
+    !blob_reader_read_array(reader, &self->predicate_steps) ||
+    !blob_reader_read_array(reader, &self->predicates_by_pattern) ||
+    !blob_reader_read_array(reader, &self->start_bytes_by_pattern)
+  ) return false;
+  if (has_symbol_map) {
+    uint32_t symbol_count = ts_language_symbol_count(self->language);
+    self->symbol_map = ts_malloc(symbol_count * sizeof(TSSymbol));
+    if (!blob_reader_read(reader, self->symbol_map, symbol_count * sizeof(TSSymbol))) {
+      return false;
+    }
+  }
+  return reader->input == reader->end;
+}
+
+// The indices between the arrays stay inside them, so a blob that passed the
+// checksum but was written by a broken tool is still not read out of bounds.
+static bool ts_query__is_consistent(const TSQuery *self) {
+  const SymbolTable *tables[] = {&self->captures, &self->predicate_values};
+  for (unsigned i = 0; i < 2; i++) {
+    for (unsigned j = 0; j < tables[i]->slices.size; j++) {
+      Slice slice = tables[i]->slices.contents[j];
+      if (slice.offset + (uint64_t)slice.length >= tables[i]->characters.size) return false;
+    }
+  }
+  for (unsigned i = 0; i < self->pattern_map.size; i++) {
+    PatternEntry *entry = &self->pattern_map.contents[i];
+    if (entry->step_index >= self->steps.size) return false;
+    if (entry->pattern_index >= self->predicates_by_pattern.size) return false;
+  }
+  for (unsigned i = 0; i < self->predicates_by_pattern.size; i++) {
+    Slice slice = self->predicates_by_pattern.contents[i];
+    if (slice.offset + (uint64_t)slice.length > self->predicate_steps.size) return false;
+  }
+  for (unsigned i = 0; i < self->steps.size; i++) {
+    QueryStep *step = &self->steps.contents[i];
+    if (step->repeat_step_index != NONE && step->repeat_step_index >= self->steps.size) return false;
+    for (unsigned j = 0; j < MAX_STEP_CAPTURE_COUNT; j++) {
+      uint16_t id = step->capture_ids[j];
+      if (id != NONE && id >= self->captures.slices.size) return false;
+    }
+  }
+  if (self->start_bytes_by_pattern.size != self->predicates_by_pattern.size) return false;
+  return
+    self->steps.size == 0 ||
+    self->steps.contents[self->steps.size - 1].depth == PATTERN_DONE_MARKER;
+}
+
+void *ts_query_serialize(const TSQuery *self, uint32_t *length) {
+  BlobWriter writer = {NULL, sizeof(QueryBlobHeader)};
+  ts_query__write(self, &writer);
+  writer.contents = ts_malloc(writer.size);
+  *length = writer.size;
+  writer.size = sizeof(QueryBlobHeader);
+  ts_query__write(self, &writer);
+
+  QueryBlobHeader header = {
+    .magic = QUERY_BLOB_MAGIC,
+    .format_version = QUERY_BLOB_FORMAT_VERSION,
+    .step_size = sizeof(QueryStep),
+    .length = writer.size,
+    .checksum = 0,
+    .language_version = ts_language_version(self->language),
+    .language_hash = ts_query__language_hash(self->language),
+    .root_symbol_summary = self->root_symbol_summary,
+    .wildcard_root_pattern_count = self->wildcard_root_pattern_count,
+    .has_symbol_map = self->symbol_map != NULL,
+  };
+  uint64_t hash = blob_hash(BLOB_HASH_SEED, &header, sizeof(header));
+  hash = blob_hash(
+    hash,
+    &writer.contents[sizeof(header)],
+    writer.size - sizeof(header)
+  );
+  header.checksum = (uint32_t)hash;
+  memcpy(writer.contents, &header, sizeof(header));
+  return writer.contents;
+}
+
+TSQuery *ts_query_deserialize(
+  const TSLanguage *language,
+  const void *data,
+  uint32_t length
+) {
+  QueryBlobHeader header;
+  if (length < sizeof(header)) return NULL;
+  memcpy(&header, data, sizeof(header));
+  const char *payload = (const char *)data + sizeof(header);
+  uint32_t payload_length = length - sizeof(header);
+
+  // The checksum covers the header with the checksum itself zeroed.
+  uint32_t checksum = header.checksum;
+  header.checksum = 0;
+  uint64_t hash = blob_hash(BLOB_HASH_SEED, &header, sizeof(header));
+  hash = blob_hash(hash, payload, payload_length);
+  if (
+    header.magic != QUERY_BLOB_MAGIC ||
+    header.format_version != QUERY_BLOB_FORMAT_VERSION ||
+    header.step_size != sizeof(QueryStep) ||
+    header.length != length ||
+    header.language_version != ts_language_version(language) ||
+    header.has_symbol_map != (
+      ts_language_version(language) < TREE_SITTER_LANGUAGE_VERSION_WITH_SYMBOL_DEDUPING
+    ) ||
+    checksum != (uint32_t)hash ||
+    header.language_hash != ts_query__language_hash(language)
+  ) return NULL;
+
+  TSQuery *self = ts_malloc(sizeof(TSQuery));
+  *self = (TSQuery) {
+    .steps = array_new(),
+    .pattern_map = array_new(),
+    .captures = symbol_table_new(),
+    .predicate_values = symbol_table_new(),
+    .predicate_steps = array_new(),
+    .predicates_by_pattern = array_new(),
+    .symbol_map = NULL,
+    .wildcard_root_pattern_count = header.wildcard_root_pattern_count,
+    .root_symbol_summary = header.root_symbol_summary,
+    .language = language,
+  };
+  BlobReader reader = {payload, payload + payload_length};
+  if (!ts_query__read(self, &reader, header.has_symbol_map) || !ts_query__is_consistent(self)) {
+    ts_query_delete(self);
+    return NULL;
+  }
+  return self;
+}
+
 /***************
  * QueryCursor
  ***************/
@@ -1101,6 +1443,8 @@ TSQueryCursor *ts_query_cursor_new() {
     .end_byte = UINT32_MAX,
     .start_point = {0, 0},
     .end_point = POINT_MAX,
+    .match_limit = MAX_CAPTURE_LIST_COUNT,
+    .overflow_count = 0,
   };
   array_reserve(&self->states, MAX_STATE_COUNT);
   array_reserve(&self->finished_states, MAX_STATE_COUNT);
@@ -1123,7 +1467,8 @@ void ts_query_cursor_exec(
   array_clear(&self->states);
   array_clear(&self->finished_states);
   ts_tree_cursor_reset(&self->cursor, node);
-  capture_list_pool_reset(&self->capture_list_pool);
+  capture_list_pool_reset(&self->capture_list_pool, self->match_limit);
+  self->overflow_count = 0;
   self->next_state_id = 0;
   self->depth = 0;
   self->ascending = false;
@@ -1156,6 +1501,20 @@ void ts_query_cursor_set_point_range(
   self->end_point = end_point;
 }
 
+void ts_query_cursor_set_match_limit(TSQueryCursor *self, uint32_t limit) {
+  if (limit == 0) limit = 1;
+  if (limit > MAX_CAPTURE_LIST_COUNT) limit = MAX_CAPTURE_LIST_COUNT;
+  self->match_limit = limit;
+}
+
+uint32_t ts_query_cursor_match_limit(const TSQueryCursor *self) {
+  return self->match_limit;
+}
+
+uint32_t ts_query_cursor_overflow_count(const TSQueryCursor *self) {
+  return self->overflow_count;
+}
+
 const char *ts_query_cursor_get_name(TSQueryCursor *cursor, uint32_t index, uint32_t *length) {
   return ts_query_capture_name_for_id(cursor->query, index, length);
 }
@@ -1218,6 +1577,7 @@ static bool ts_query__cursor_add_state(
   // state has captured the earliest node in the document, and steal its
   // capture list.
   if (list_id == NONE) {
+    self->overflow_count++;
     uint32_t state_index, byte_offset, pattern_index;
     if (ts_query_cursor__first_in_progress_capture(
       self,
@@ -1255,13 +1615,22 @@ static bool ts_query__cursor_add_state(
   return true;
 }
 
+// The states array can grow, so the given state pointer is updated to the
+// state's new address.
 static QueryState *ts_query__cursor_copy_state(
   TSQueryCursor *self,
-  const QueryState *state
+  QueryState **state_ref
 ) {
   uint32_t new_list_id = capture_list_pool_acquire(&self->capture_list_pool);
-  if (new_list_id == NONE) return NULL;
-  array_push(&self->states, *state);
+  if (new_list_id == NONE) {
+    self->overflow_count++;
+    return NULL;
+  }
+  uint32_t state_index = *state_ref - self->states.contents;
+  QueryState copy = **state_ref;
+  array_push(&self->states, copy);
+  QueryState *state = &self->states.contents[state_index];
+  *state_ref = state;
   QueryState *new_state = array_back(&self->states);
   new_state->capture_list_id = new_list_id;
   CaptureList *old_captures = capture_list_pool_get(
@@ -1280,6 +1649,30 @@ static QueryState *ts_query__cursor_copy_state(
 // If one or more patterns finish, return `true` and store their states in the
 // `finished_states` array. Multiple patterns can finish on the same node. If
 // there are no more matches, return `false`.
+// The summary bits of the nodes worth visiting at the given depth and below:
+// the pattern roots, and the next step of each state that waits deeper. A
+// state waiting at that depth itself has to see every node there.
+static inline uint32_t ts_query_cursor__summary_mask(const TSQueryCursor *self, uint32_t depth) {
+  uint32_t mask = self->query->root_symbol_summary;
+  for (unsigned i = 0; i < self->states.size; i++) {
+    const QueryState *state = &self->states.contents[i];
+    const QueryStep *step = &self->query->steps.contents[state->step_index];
+    uint32_t step_depth = (uint32_t)state->start_depth + (uint32_t)step->depth;
+    if (step_depth < depth) continue;
+
+    // A repetition can fall through to a later step on any node.
+    if (
+      step_depth == depth ||
+      state->step_index_on_failure != NONE ||
+      step->symbol == WILDCARD_SYMBOL ||
+      step->symbol == NAMED_WILDCARD_SYMBOL ||
+      self->query->symbol_map
+    ) return UINT32_MAX;
+    mask |= ts_symbol_summary_bit(step->symbol);
+  }
+  return mask;
+}
+
 static inline bool ts_query_cursor__advance(TSQueryCursor *self) {
   do {
     if (self->ascending) {
@@ -1311,7 +1704,11 @@ static inline bool ts_query_cursor__advance(TSQueryCursor *self) {
 
       self->states.size -= deleted_count;
 
-      if (ts_tree_cursor_goto_next_sibling(&self->cursor)) {
+      if (ts_tree_cursor_goto_next_sibling_in_summary(
+        &self->cursor,
+        ts_query_cursor__summary_mask(self, self->depth),
+        self->start_byte
+      )) {
         self->ascending = false;
       } else if (ts_tree_cursor_goto_parent(&self->cursor)) {
         self->depth--;
@@ -1334,12 +1731,17 @@ static inline bool ts_query_cursor__advance(TSQueryCursor *self) {
       }
 
       // If this node is before the selected range, then avoid descending
-      // into it.
+      // into it. The hidden subtrees that end before the range are skipped
+      // whole on the way to the next sibling.
       if (
         ts_node_end_byte(node) <= self->start_byte ||
         point_lte(ts_node_end_point(node), self->start_point)
       ) {
-        if (!ts_tree_cursor_goto_next_sibling(&self->cursor)) {
+        if (!ts_tree_cursor_goto_next_sibling_in_summary(
+          &self->cursor,
+          ts_query_cursor__summary_mask(self, self->depth),
+          self->start_byte
+        )) {
           self->ascending = true;
         }
         continue;
@@ -1486,7 +1888,7 @@ static inline bool ts_query_cursor__advance(TSQueryCursor *self) {
           later_sibling_can_match &&
           state->repeat_match_count == 0
         ) {
-          QueryState *copy = ts_query__cursor_copy_state(self, state);
+          QueryState *copy = ts_query__cursor_copy_state(self, &state);
 
           // The QueryState that matched this node has begun matching a repeating
           // sequence. The QueryState that *skipped* this node should not start
@@ -1568,8 +1970,14 @@ static inline bool ts_query_cursor__advance(TSQueryCursor *self) {
       }
 
 
-      // Continue descending if possible.
-      if (ts_tree_cursor_goto_first_child(&self->cursor)) {
+      // Continue descending if possible. The subtrees whose symbol summary
+      // rules out everything that could match below are skipped.
+      const TreeCursor *cursor = (const TreeCursor *)&self->cursor;
+      uint32_t summary_mask = ts_query_cursor__summary_mask(self, self->depth + 1);
+      if (
+        (ts_subtree_symbol_summary(*array_back(&cursor->stack)->subtree) & summary_mask) &&
+        ts_tree_cursor_goto_first_child_in_summary(&self->cursor, summary_mask, self->start_byte)
+      ) {
         self->depth++;
       } else {
         self->ascending = true;
@@ -1585,7 +1993,10 @@ bool ts_query_cursor_next_match(
   TSQueryMatch *match
 ) {
   if (self->finished_states.size == 0) {
-    if (!ts_query_cursor__advance(self)) {
+    TS_TRACE_BEGIN(advance);
+    bool did_advance = ts_query_cursor__advance(self);
+    TS_TRACE_END(advance, "ts_query_cursor__advance");
+    if (!did_advance) {
       return false;
     }
   }
@@ -1701,6 +2112,7 @@ bool ts_query_cursor_next_capture(
       }
 
       if (capture_list_pool_is_empty(&self->capture_list_pool)) {
+        self->overflow_count++;
         LOG(
           "  abandon state. index:%u, pattern:%u, offset:%u.\n",
           first_unfinished_state_index,
@@ -1717,7 +2129,10 @@ bool ts_query_cursor_next_capture(
 
     // If there are no finished matches that are ready to be returned, then
     // continue finding more matches.
-    if (!ts_query_cursor__advance(self)) return false;
+    TS_TRACE_BEGIN(advance);
+    bool did_advance = ts_query_cursor__advance(self);
+    TS_TRACE_END(advance, "ts_query_cursor__advance");
+    if (!did_advance) return false;
   }
 }
 
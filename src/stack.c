@@ -1,3 +1,6 @@
+#undef TS_ALLOCATION_SUBSYSTEM
+#define TS_ALLOCATION_SUBSYSTEM TSAllocationSubsystemStack
+
 #include "./alloc.h"
 #include "./language.h"
 #include "./subtree.h"
@@ -7,8 +10,6 @@
 #include <assert.h>
 #include <stdio.h>
 
-#define MAX_LINK_COUNT 8
-#define MAX_NODE_POOL_SIZE 50
 #define MAX_ITERATOR_COUNT 64
 
 #if defined _WIN32 && !defined __GNUC__
@@ -28,7 +29,7 @@ typedef struct {
 struct StackNode {
   TSStateId state;
   Length position;
-  StackLink links[MAX_LINK_COUNT];
+  StackLink links[STACK_MAX_LINK_COUNT];
   short unsigned int link_count;
   uint32_t ref_count;
   unsigned error_cost;
@@ -72,6 +73,8 @@ struct Stack {
   StackNodeArray node_pool;
   StackNode *base_node;
   SubtreePool *subtree_pool;
+  unsigned max_node_pool_size;
+  unsigned max_link_count;
 };
 
 typedef unsigned StackAction;
@@ -91,7 +94,8 @@ static void stack_node_retain(StackNode *self) {
   assert(self->ref_count != 0);
 }
 
-static void stack_node_release(StackNode *self, StackNodeArray *pool, SubtreePool *subtree_pool) {
+static void stack_node_release(StackNode *self, StackNodeArray *pool, unsigned max_pool_size,
+                               SubtreePool *subtree_pool) {
 recur:
   assert(self->ref_count != 0);
   self->ref_count--;
@@ -102,14 +106,14 @@ recur:
     for (unsigned i = self->link_count - 1; i > 0; i--) {
       StackLink link = self->links[i];
       if (link.subtree.ptr) ts_subtree_release(subtree_pool, link.subtree);
-      stack_node_release(link.node, pool, subtree_pool);
+      stack_node_release(link.node, pool, max_pool_size, subtree_pool);
     }
     StackLink link = self->links[0];
     if (link.subtree.ptr) ts_subtree_release(subtree_pool, link.subtree);
     first_predecessor = self->links[0].node;
   }
 
-  if (pool->size < MAX_NODE_POOL_SIZE) {
+  if (pool->size < max_pool_size) {
     array_push(pool, self);
   } else {
     ts_free(self);
@@ -168,7 +172,8 @@ static bool stack__subtree_is_equivalent(Subtree left, Subtree right) {
        ts_subtree_external_scanner_state_eq(left, right))));
 }
 
-static void stack_node_add_link(StackNode *self, StackLink link, SubtreePool *subtree_pool) {
+static void stack_node_add_link(StackNode *self, StackLink link, unsigned max_link_count,
+                                SubtreePool *subtree_pool) {
   if (link.node == self) return;
 
   for (int i = 0; i < self->link_count; i++) {
@@ -196,7 +201,7 @@ static void stack_node_add_link(StackNode *self, StackLink link, SubtreePool *su
       if (existing_link->node->state == link.node->state &&
           existing_link->node->position.bytes == link.node->position.bytes) {
         for (int j = 0; j < link.node->link_count; j++) {
-          stack_node_add_link(existing_link->node, link.node->links[j], subtree_pool);
+          stack_node_add_link(existing_link->node, link.node->links[j], max_link_count, subtree_pool);
         }
         int32_t dynamic_precedence = link.node->dynamic_precedence;
         if (link.subtree.ptr) {
@@ -210,7 +215,7 @@ static void stack_node_add_link(StackNode *self, StackLink link, SubtreePool *su
     }
   }
 
-  if (self->link_count == MAX_LINK_COUNT) return;
+  if (self->link_count >= max_link_count) return;
 
   stack_node_retain(link.node);
   unsigned node_count = link.node->node_count;
@@ -227,7 +232,8 @@ static void stack_node_add_link(StackNode *self, StackLink link, SubtreePool *su
   if (dynamic_precedence > self->dynamic_precedence) self->dynamic_precedence = dynamic_precedence;
 }
 
-static void stack_head_delete(StackHead *self, StackNodeArray *pool, SubtreePool *subtree_pool) {
+static void stack_head_delete(StackHead *self, StackNodeArray *pool, unsigned max_pool_size,
+                              SubtreePool *subtree_pool) {
   if (self->node) {
     if (self->last_external_token.ptr) {
       ts_subtree_release(subtree_pool, self->last_external_token);
@@ -236,7 +242,7 @@ static void stack_head_delete(StackHead *self, StackNodeArray *pool, SubtreePool
       array_delete(self->summary);
       ts_free(self->summary);
     }
-    stack_node_release(self->node, pool, subtree_pool);
+    stack_node_release(self->node, pool, max_pool_size, subtree_pool);
   }
 }
 
@@ -372,7 +378,9 @@ Stack *ts_stack_new(SubtreePool *subtree_pool) {
   array_reserve(&self->heads, 4);
   array_reserve(&self->slices, 4);
   array_reserve(&self->iterators, 4);
-  array_reserve(&self->node_pool, MAX_NODE_POOL_SIZE);
+  array_reserve(&self->node_pool, STACK_DEFAULT_NODE_POOL_SIZE);
+  self->max_node_pool_size = STACK_DEFAULT_NODE_POOL_SIZE;
+  self->max_link_count = STACK_MAX_LINK_COUNT;
 
   self->subtree_pool = subtree_pool;
   self->base_node = stack_node_new(NULL, NULL_SUBTREE, false, 1, &self->node_pool);
@@ -386,9 +394,9 @@ void ts_stack_delete(Stack *self) {
     array_delete(&self->slices);
   if (self->iterators.contents)
     array_delete(&self->iterators);
-  stack_node_release(self->base_node, &self->node_pool, self->subtree_pool);
+  stack_node_release(self->base_node, &self->node_pool, self->max_node_pool_size, self->subtree_pool);
   for (uint32_t i = 0; i < self->heads.size; i++) {
-    stack_head_delete(&self->heads.contents[i], &self->node_pool, self->subtree_pool);
+    stack_head_delete(&self->heads.contents[i], &self->node_pool, self->max_node_pool_size, self->subtree_pool);
   }
   array_clear(&self->heads);
   if (self->node_pool.contents) {
@@ -400,6 +408,16 @@ void ts_stack_delete(Stack *self) {
   ts_free(self);
 }
 
+void ts_stack_set_limits(Stack *self, unsigned max_node_pool_size, unsigned max_link_count) {
+  if (max_link_count < 1) max_link_count = 1;
+  if (max_link_count > STACK_MAX_LINK_COUNT) max_link_count = STACK_MAX_LINK_COUNT;
+  self->max_link_count = max_link_count;
+  self->max_node_pool_size = max_node_pool_size;
+  while (self->node_pool.size > max_node_pool_size) {
+    ts_free(array_pop(&self->node_pool));
+  }
+}
+
 uint32_t ts_stack_version_count(const Stack *self) {
   return self->heads.size;
 }
@@ -605,7 +623,7 @@ bool ts_stack_has_advanced_since_error(const Stack *self, StackVersion version)
 }
 
 void ts_stack_remove_version(Stack *self, StackVersion version) {
-  stack_head_delete(array_get(&self->heads, version), &self->node_pool, self->subtree_pool);
+  stack_head_delete(array_get(&self->heads, version), &self->node_pool, self->max_node_pool_size, self->subtree_pool);
   array_erase(&self->heads, version);
 }
 
@@ -619,7 +637,7 @@ void ts_stack_renumber_version(Stack *self, StackVersion v1, StackVersion v2) {
     source_head->summary = target_head->summary;
     target_head->summary = NULL;
   }
-  stack_head_delete(target_head, &self->node_pool, self->subtree_pool);
+  stack_head_delete(target_head, &self->node_pool, self->max_node_pool_size, self->subtree_pool);
   *target_head = *source_head;
   array_erase(&self->heads, v1);
 }
@@ -645,7 +663,7 @@ bool ts_stack_merge(Stack *self, StackVersion version1, StackVersion version2) {
   StackHead *head1 = &self->heads.contents[version1];
   StackHead *head2 = &self->heads.contents[version2];
   for (uint32_t i = 0; i < head2->node->link_count; i++) {
-    stack_node_add_link(head1->node, head2->node->links[i], self->subtree_pool);
+    stack_node_add_link(head1->node, head2->node->links[i], self->max_link_count, self->subtree_pool);
   }
   if (head1->node->state == ERROR_STATE) {
     head1->node_count_at_last_error = head1->node->node_count;
@@ -701,7 +719,7 @@ TSSymbol ts_stack_resume(Stack *self, StackVersion version) {
 void ts_stack_clear(Stack *self) {
   stack_node_retain(self->base_node);
   for (uint32_t i = 0; i < self->heads.size; i++) {
-    stack_head_delete(&self->heads.contents[i], &self->node_pool, self->subtree_pool);
+    stack_head_delete(&self->heads.contents[i], &self->node_pool, self->max_node_pool_size, self->subtree_pool);
   }
   array_clear(&self->heads);
   array_push(&self->heads, ((StackHead){
@@ -12,6 +12,11 @@ extern "C" {
 
 typedef struct Stack Stack;
 
+// The default number of freed stack nodes kept for reuse, and the default and
+// largest number of links from one stack node to its predecessors.
+#define STACK_DEFAULT_NODE_POOL_SIZE 50
+#define STACK_MAX_LINK_COUNT 8
+
 typedef unsigned StackVersion;
 #define STACK_VERSION_NONE ((StackVersion)-1)
 
@@ -34,6 +39,10 @@ Stack *ts_stack_new(SubtreePool *);
 // Release the memory reserved for a given stack.
 void ts_stack_delete(Stack *);
 
+// Set how many freed nodes are kept for reuse and how many links a node may
+// have. The link count is clamped to `STACK_MAX_LINK_COUNT`.
+void ts_stack_set_limits(Stack *, unsigned max_node_pool_size, unsigned max_link_count);
+
 // Get the stack's current number of versions.
 uint32_t ts_stack_version_count(const Stack *);
 
@@ -1,3 +1,6 @@
+#undef TS_ALLOCATION_SUBSYSTEM
+#define TS_ALLOCATION_SUBSYSTEM TSAllocationSubsystemSubtree
+
 #include <assert.h>
 #include <ctype.h>
 #include <limits.h>
@@ -19,7 +22,8 @@ typedef struct {
 } Edit;
 
 #define TS_MAX_INLINE_TREE_LENGTH UINT8_MAX
-#define TS_MAX_TREE_POOL_SIZE 32
+#define TS_MAX_TREE_POOL_SIZE 1024
+#define TS_SUBTREE_SLAB_SIZE (16 * 1024)
 
 static const ExternalScannerState empty_state = {{.short_data = {0}}, .length = 0};
 
@@ -111,10 +115,57 @@ void ts_subtree_array_reverse(SubtreeArray *self) {
   }
 }
 
+// SubtreeSlab
+
+typedef union {
+  SubtreeSlab *slab;
+  uint64_t alignment;
+} SubtreeSlabBlock;
+
+#define ts_subtree_slab__align(size) (((size) + 7) & ~(size_t)7)
+
+static SubtreeSlab *ts_subtree_slab_new(uint32_t size, uint32_t ref_count) {
+  SubtreeSlab *self = ts_malloc(sizeof(SubtreeSlabBlock) + size);
+  self->ref_count = ref_count;
+  self->size = size;
+  return self;
+}
+
+static void ts_subtree_slab_release(SubtreeSlab *self) {
+  if (atomic_dec(&self->ref_count) == 0) {
+    ts_free(self);
+  }
+}
+
+static inline void *ts_subtree_slab__carve(SubtreeSlab *self, uint32_t *offset, size_t size) {
+  SubtreeSlabBlock *block = (SubtreeSlabBlock *)((char *)self + sizeof(SubtreeSlabBlock) + *offset);
+  block->slab = self;
+  *offset += sizeof(SubtreeSlabBlock) + ts_subtree_slab__align(size);
+  return block + 1;
+}
+
+// Free a block that was carved from a slab or allocated on its own
+static void ts_subtree_block_free(void *data) {
+  SubtreeSlabBlock *block = (SubtreeSlabBlock *)data - 1;
+  if (block->slab) {
+    ts_subtree_slab_release(block->slab);
+  } else {
+    ts_free(block);
+  }
+}
+
+static inline void ts_subtree__free_children(SubtreeHeapData *self) {
+  if (self->slab_children) {
+    ts_subtree_block_free(self->children);
+  } else {
+    ts_free(self->children);
+  }
+}
+
 // SubtreePool
 
 SubtreePool ts_subtree_pool_new(uint32_t capacity) {
-  SubtreePool self = {array_new(), array_new()};
+  SubtreePool self = {array_new(), array_new(), NULL, 0};
   array_reserve(&self.free_trees, capacity);
   return self;
 }
@@ -122,26 +173,45 @@ SubtreePool ts_subtree_pool_new(uint32_t capacity) {
 void ts_subtree_pool_delete(SubtreePool *self) {
   if (self->free_trees.contents) {
     for (unsigned i = 0; i < self->free_trees.size; i++) {
-      ts_free(self->free_trees.contents[i].ptr);
+      ts_subtree_block_free(self->free_trees.contents[i].ptr);
     }
     array_delete(&self->free_trees);
   }
   if (self->tree_stack.contents) array_delete(&self->tree_stack);
+  if (self->slab) {
+    ts_subtree_slab_release(self->slab);
+    self->slab = NULL;
+  }
 }
 
 static SubtreeHeapData *ts_subtree_pool_allocate(SubtreePool *self) {
   if (self->free_trees.size > 0) {
     return array_pop(&self->free_trees).ptr;
-  } else {
-    return ts_malloc(sizeof(SubtreeHeapData));
   }
+
+  // Temporary pools, like the ones used to edit a tree, allocate each node on
+  // its own so that a few new nodes don't keep a whole slab alive.
+  if (self->free_trees.capacity == 0) {
+    SubtreeSlabBlock *block = ts_malloc(sizeof(SubtreeSlabBlock) + sizeof(SubtreeHeapData));
+    block->slab = NULL;
+    return (SubtreeHeapData *)(block + 1);
+  }
+
+  size_t size = sizeof(SubtreeSlabBlock) + ts_subtree_slab__align(sizeof(SubtreeHeapData));
+  if (!self->slab || self->slab_offset + size > self->slab->size) {
+    if (self->slab) ts_subtree_slab_release(self->slab);
+    self->slab = ts_subtree_slab_new(TS_SUBTREE_SLAB_SIZE, 1);
+    self->slab_offset = 0;
+  }
+  atomic_inc(&self->slab->ref_count);
+  return ts_subtree_slab__carve(self->slab, &self->slab_offset, sizeof(SubtreeHeapData));
 }
 
 static void ts_subtree_pool_free(SubtreePool *self, SubtreeHeapData *tree) {
   if (self->free_trees.capacity > 0 && self->free_trees.size + 1 <= TS_MAX_TREE_POOL_SIZE) {
     array_push(&self->free_trees, (MutableSubtree) {.ptr = tree});
   } else {
-    ts_free(tree);
+    ts_subtree_block_free(tree);
   }
 }
 
@@ -208,6 +278,8 @@ Subtree ts_subtree_new_leaf(
       .has_external_tokens = has_external_tokens,
       .is_missing = false,
       .is_keyword = is_keyword,
+      .slab_children = false,
+      .is_balanced = true,
       {{.first_leaf = {.symbol = 0, .parse_state = 0}}}
     };
     return (Subtree) {.ptr = data};
@@ -255,6 +327,7 @@ MutableSubtree ts_subtree_make_mut(SubtreePool *pool, Subtree self) {
   memcpy(result, self.ptr, sizeof(SubtreeHeapData));
   if (result->child_count > 0) {
     result->children = ts_calloc(self.ptr->child_count, sizeof(Subtree));
+    result->slab_children = false;
     memcpy(result->children, self.ptr->children, result->child_count * sizeof(Subtree));
     for (uint32_t i = 0; i < result->child_count; i++) {
       ts_subtree_retain(result->children[i]);
@@ -312,7 +385,7 @@ static void ts_subtree__compress(MutableSubtree self, unsigned count, const TSLa
 void ts_subtree_balance(Subtree self, SubtreePool *pool, const TSLanguage *language) {
   array_clear(&pool->tree_stack);
 
-  if (ts_subtree_child_count(self) > 0 && self.ptr->ref_count == 1) {
+  if (!ts_subtree_is_balanced(self) && self.ptr->ref_count == 1) {
     array_push(&pool->tree_stack, ts_subtree_to_mut_unsafe(self));
   }
 
@@ -334,7 +407,7 @@ void ts_subtree_balance(Subtree self, SubtreePool *pool, const TSLanguage *langu
 
     for (uint32_t i = 0; i < tree.ptr->child_count; i++) {
       Subtree child = tree.ptr->children[i];
-      if (ts_subtree_child_count(child) > 0 && child.ptr->ref_count == 1) {
+      if (!ts_subtree_is_balanced(child) && child.ptr->ref_count == 1) {
         array_push(&pool->tree_stack, ts_subtree_to_mut_unsafe(child));
       }
     }
@@ -346,8 +419,9 @@ void ts_subtree_set_children(
 ) {
   assert(!self.data.is_inline);
 
-  if (self.ptr->child_count > 0 && children != self.ptr->children) {
-    ts_free(self.ptr->children);
+  if (children != self.ptr->children) {
+    if (self.ptr->child_count > 0) ts_subtree__free_children(self.ptr);
+    self.ptr->slab_children = false;
   }
 
   self.ptr->child_count = child_count;
@@ -359,6 +433,8 @@ void ts_subtree_set_children(
   self.ptr->node_count = 1;
   self.ptr->has_external_tokens = false;
   self.ptr->dynamic_precedence = 0;
+  self.ptr->is_balanced = true;
+  self.ptr->symbol_summary = 0;
 
   uint32_t non_extra_index = 0;
   const TSSymbol *alias_sequence = ts_language_alias_sequence(language, self.ptr->production_id);
@@ -387,7 +463,9 @@ void ts_subtree_set_children(
     self.ptr->dynamic_precedence += ts_subtree_dynamic_precedence(child);
     self.ptr->node_count += ts_subtree_node_count(child);
 
+    TSSymbol child_symbol = ts_subtree_symbol(child);
     if (alias_sequence && alias_sequence[non_extra_index] != 0 && !ts_subtree_extra(child)) {
+      child_symbol = alias_sequence[non_extra_index];
       self.ptr->visible_child_count++;
       if (ts_language_symbol_metadata(language, alias_sequence[non_extra_index]).named) {
         self.ptr->named_child_count++;
@@ -401,6 +479,11 @@ void ts_subtree_set_children(
     }
 
     if (ts_subtree_has_external_tokens(child)) self.ptr->has_external_tokens = true;
+    if (!ts_subtree_is_balanced(child)) self.ptr->is_balanced = false;
+    self.ptr->symbol_summary |= ts_subtree_symbol_summary(child);
+    if (child_symbol != ts_builtin_sym_error_repeat) {
+      self.ptr->symbol_summary |= ts_symbol_summary_bit(ts_language_public_symbol(language, child_symbol));
+    }
 
     if (ts_subtree_is_error(child)) {
       self.ptr->fragile_left = self.ptr->fragile_right = true;
@@ -451,6 +534,10 @@ void ts_subtree_set_children(
       } else {
         self.ptr->repeat_depth = ts_subtree_repeat_depth(last_child) + 1;
       }
+
+      // the same test ts_subtree_balance compresses a repetition on
+      long repeat_delta = (long)ts_subtree_repeat_depth(first_child) - (long)ts_subtree_repeat_depth(last_child);
+      if (repeat_delta >= 2) self.ptr->is_balanced = false;
     }
   }
 }
@@ -470,6 +557,8 @@ MutableSubtree ts_subtree_new_node(SubtreePool *pool, TSSymbol symbol,
     .fragile_left = fragile,
     .fragile_right = fragile,
     .is_keyword = false,
+    .slab_children = false,
+    .is_balanced = true,
     {{
       .node_count = 0,
       .production_id = production_id,
@@ -533,7 +622,7 @@ void ts_subtree_release(SubtreePool *pool, Subtree self) {
           array_push(&pool->tree_stack, ts_subtree_to_mut_unsafe(child));
         }
       }
-      ts_free(tree.ptr->children);
+      ts_subtree__free_children(tree.ptr);
     } else if (tree.ptr->has_external_tokens) {
       ts_external_scanner_state_delete(&tree.ptr->external_scanner_state);
     }
@@ -597,6 +686,139 @@ static inline void ts_subtree_set_has_changes(MutableSubtree *self) {
   }
 }
 
+// Set the padding and size of a mutable subtree, moving an inline leaf onto
+// the heap when the new lengths no longer fit inline.
+static MutableSubtree ts_subtree__resize(SubtreePool *pool, MutableSubtree self, Length padding,
+                                         Length size, uint32_t lookahead_bytes) {
+  if (!self.data.is_inline) {
+    self.ptr->padding = padding;
+    self.ptr->size = size;
+    return self;
+  }
+
+  if (ts_subtree_can_inline(padding, size, lookahead_bytes)) {
+    self.data.padding_bytes = padding.bytes;
+    self.data.padding_rows = padding.extent.row;
+    self.data.padding_columns = padding.extent.column;
+    self.data.size_bytes = size.bytes;
+    return self;
+  }
+
+  SubtreeHeapData *data = ts_subtree_pool_allocate(pool);
+  data->ref_count = 1;
+  data->padding = padding;
+  data->size = size;
+  data->lookahead_bytes = lookahead_bytes;
+  data->error_cost = 0;
+  data->child_count = 0;
+  data->symbol = self.data.symbol;
+  data->parse_state = self.data.parse_state;
+  data->visible = self.data.visible;
+  data->named = self.data.named;
+  data->extra = self.data.extra;
+  data->fragile_left = false;
+  data->fragile_right = false;
+  data->has_changes = false;
+  data->has_external_tokens = false;
+  data->is_missing = self.data.is_missing;
+  data->is_keyword = self.data.is_keyword;
+  data->slab_children = false;
+  return (MutableSubtree) {.ptr = data};
+}
+
+// Move and resize a subtree's padding and size for an edit given in the
+// subtree's coordinates. Returns false if the edit doesn't reach the subtree.
+static bool ts_subtree__edit_lengths(Edit edit, uint32_t lookahead_bytes, Length *padding, Length *size) {
+  bool is_noop = edit.old_end.bytes == edit.start.bytes && edit.new_end.bytes == edit.start.bytes;
+  bool is_pure_insertion = edit.old_end.bytes == edit.start.bytes;
+  uint32_t end_byte = padding->bytes + size->bytes + lookahead_bytes;
+  if (edit.start.bytes > end_byte || (is_noop && edit.start.bytes == end_byte)) return false;
+
+  // If the edit is entirely within the space before this subtree, then shift this
+  // subtree over according to the edit without changing its size.
+  if (edit.old_end.bytes <= padding->bytes) {
+    *padding = length_add(edit.new_end, length_sub(*padding, edit.old_end));
+  }
+
+  // If the edit starts in the space before this subtree and extends into this subtree,
+  // shrink the subtree's content to compensate for the change in the space before it.
+  else if (edit.start.bytes < padding->bytes) {
+    *size = length_sub(*size, length_sub(edit.old_end, *padding));
+    *padding = edit.new_end;
+  }
+
+  // If the edit is a pure insertion right at the start of the subtree,
+  // shift the subtree over according to the insertion.
+  else if (edit.start.bytes == padding->bytes && is_pure_insertion) {
+    *padding = edit.new_end;
+  }
+
+  // If the edit is within this subtree, resize the subtree to reflect the edit.
+  else {
+    uint32_t total_bytes = padding->bytes + size->bytes;
+    if (edit.start.bytes < total_bytes ||
+       (edit.start.bytes == total_bytes && is_pure_insertion)) {
+      *size = length_add(
+        length_sub(edit.new_end, *padding),
+        length_sub(*size, length_sub(edit.old_end, *padding))
+      );
+    }
+  }
+
+  return true;
+}
+
+// Whether a child spanning [child_left, child_right) is reached by an edit.
+// Sets `done` once the children from this one on all start after the edit.
+static inline bool ts_subtree__child_touches_edit(
+  const Edit *edit, Length child_left, Length child_right,
+  uint32_t child_lookahead_bytes, uint32_t index, bool *done
+) {
+  // If this child ends before the edit, it is not affected.
+  if (child_right.bytes + child_lookahead_bytes < edit->start.bytes) return false;
+
+  // If this child starts after the edit, then we're done processing children.
+  if (child_left.bytes > edit->old_end.bytes ||
+      (child_left.bytes == edit->old_end.bytes && child_right.bytes > child_left.bytes && index > 0)) {
+    *done = true;
+    return false;
+  }
+
+  return true;
+}
+
+// Transform an edit into the coordinate space of a child that it reaches.
+static Edit ts_subtree__child_edit(Edit *edit, Length child_left, Length child_right) {
+  bool is_pure_insertion = edit->old_end.bytes == edit->start.bytes;
+  Edit child_edit = {
+    .start = length_sub(edit->start, child_left),
+    .old_end = length_sub(edit->old_end, child_left),
+    .new_end = length_sub(edit->new_end, child_left),
+  };
+
+  // Clamp child_edit to the child's bounds.
+  if (edit->start.bytes < child_left.bytes) child_edit.start = length_zero();
+  if (edit->old_end.bytes < child_left.bytes) child_edit.old_end = length_zero();
+  if (edit->new_end.bytes < child_left.bytes) child_edit.new_end = length_zero();
+  if (edit->old_end.bytes > child_right.bytes) child_edit.old_end = length_sub(child_right, child_left);
+
+  // Interpret all inserted text as applying to the *first* child that touches the edit.
+  // Subsequent children are only never have any text inserted into them; they are only
+  // shrunk to compensate for the edit.
+  if (child_right.bytes > edit->start.bytes ||
+      (child_right.bytes == edit->start.bytes && is_pure_insertion)) {
+    edit->new_end = edit->start;
+  }
+
+  // Children that occur before the edit are not reshaped by the edit.
+  else {
+    child_edit.old_end = child_edit.start;
+    child_edit.new_end = child_edit.start;
+  }
+
+  return child_edit;
+}
+
 Subtree ts_subtree_edit(Subtree self, const TSInputEdit *edit, SubtreePool *pool) {
   typedef struct {
     Subtree *tree;
@@ -616,136 +838,309 @@ Subtree ts_subtree_edit(Subtree self, const TSInputEdit *edit, SubtreePool *pool
   while (stack.size) {
     StackEntry entry = array_pop(&stack);
     Edit edit = entry.edit;
-    bool is_noop = edit.old_end.bytes == edit.start.bytes && edit.new_end.bytes == edit.start.bytes;
-    bool is_pure_insertion = edit.old_end.bytes == edit.start.bytes;
 
     Length size = ts_subtree_size(*entry.tree);
     Length padding = ts_subtree_padding(*entry.tree);
     uint32_t lookahead_bytes = ts_subtree_lookahead_bytes(*entry.tree);
-    uint32_t end_byte = padding.bytes + size.bytes + lookahead_bytes;
-    if (edit.start.bytes > end_byte || (is_noop && edit.start.bytes == end_byte)) continue;
+    if (!ts_subtree__edit_lengths(edit, lookahead_bytes, &padding, &size)) continue;
 
-    // If the edit is entirely within the space before this subtree, then shift this
-    // subtree over according to the edit without changing its size.
-    if (edit.old_end.bytes <= padding.bytes) {
-      padding = length_add(edit.new_end, length_sub(padding, edit.old_end));
-    }
+    MutableSubtree result = ts_subtree__resize(
+      pool, ts_subtree_make_mut(pool, *entry.tree), padding, size, lookahead_bytes
+    );
 
-    // If the edit starts in the space before this subtree and extends into this subtree,
-    // shrink the subtree's content to compensate for the change in the space before it.
-    else if (edit.start.bytes < padding.bytes) {
-      size = length_sub(size, length_sub(edit.old_end, padding));
-      padding = edit.new_end;
-    }
+    ts_subtree_set_has_changes(&result);
+    *entry.tree = ts_subtree_from_mut(result);
 
-    // If the edit is a pure insertion right at the start of the subtree,
-    // shift the subtree over according to the insertion.
-    else if (edit.start.bytes == padding.bytes && is_pure_insertion) {
-      padding = edit.new_end;
-    }
+    Length child_left, child_right = length_zero();
+    bool done = false;
+    for (uint32_t i = 0, n = ts_subtree_child_count(*entry.tree); i < n && !done; i++) {
+      Subtree *child = &result.ptr->children[i];
+      child_left = child_right;
+      child_right = length_add(child_left, ts_subtree_total_size(*child));
+      if (!ts_subtree__child_touches_edit(
+        &edit, child_left, child_right, ts_subtree_lookahead_bytes(*child), i, &done
+      )) continue;
 
-    // If the edit is within this subtree, resize the subtree to reflect the edit.
-    else {
-      uint32_t total_bytes = padding.bytes + size.bytes;
-      if (edit.start.bytes < total_bytes ||
-         (edit.start.bytes == total_bytes && is_pure_insertion)) {
-        size = length_add(
-          length_sub(edit.new_end, padding),
-          length_sub(size, length_sub(edit.old_end, padding))
-        );
-      }
+      // Queue processing of this child's subtree.
+      array_push(&stack, ((StackEntry) {
+        .tree = child,
+        .edit = ts_subtree__child_edit(&edit, child_left, child_right),
+      }));
     }
+  }
 
-    MutableSubtree result = ts_subtree_make_mut(pool, *entry.tree);
+  array_delete(&stack);
+  return self;
+}
 
-    if (result.data.is_inline) {
-      if (ts_subtree_can_inline(padding, size, lookahead_bytes)) {
-        result.data.padding_bytes = padding.bytes;
-        result.data.padding_rows = padding.extent.row;
-        result.data.padding_columns = padding.extent.column;
-        result.data.size_bytes = size.bytes;
-      } else {
-        SubtreeHeapData *data = ts_subtree_pool_allocate(pool);
-        data->ref_count = 1;
-        data->padding = padding;
-        data->size = size;
-        data->lookahead_bytes = lookahead_bytes;
-        data->error_cost = 0;
-        data->child_count = 0;
-        data->symbol = result.data.symbol;
-        data->parse_state = result.data.parse_state;
-        data->visible = result.data.visible;
-        data->named = result.data.named;
-        data->extra = result.data.extra;
-        data->fragile_left = false;
-        data->fragile_right = false;
-        data->has_changes = false;
-        data->has_external_tokens = false;
-        data->is_missing = result.data.is_missing;
-        data->is_keyword = result.data.is_keyword;
-        result.ptr = data;
-      }
-    } else {
-      result.ptr->padding = padding;
-      result.ptr->size = size;
-    }
+// Whether `ts_subtree_edit` would copy a node with children, because the node
+// is shared with another tree.
+bool ts_subtree_edit_copies(Subtree self, const TSInputEdit *edit) {
+  typedef struct {
+    Subtree tree;
+    Edit edit;
+  } StackEntry;
 
-    ts_subtree_set_has_changes(&result);
-    *entry.tree = ts_subtree_from_mut(result);
+  Array(StackEntry) stack = array_new();
+  array_push(&stack, ((StackEntry) {
+    .tree = self,
+    .edit = (Edit) {
+      .start = {edit->start_byte, edit->start_point},
+      .old_end = {edit->old_end_byte, edit->old_end_point},
+      .new_end = {edit->new_end_byte, edit->new_end_point},
+    },
+  }));
+
+  bool result = false;
+  while (stack.size && !result) {
+    StackEntry entry = array_pop(&stack);
+    Edit edit = entry.edit;
+
+    Length size = ts_subtree_size(entry.tree);
+    Length padding = ts_subtree_padding(entry.tree);
+    uint32_t lookahead_bytes = ts_subtree_lookahead_bytes(entry.tree);
+    uint32_t child_count = ts_subtree_child_count(entry.tree);
+    if (!ts_subtree__edit_lengths(edit, lookahead_bytes, &padding, &size)) continue;
+    if (child_count > 0 && entry.tree.ptr->ref_count > 1) result = true;
 
     Length child_left, child_right = length_zero();
-    for (uint32_t i = 0, n = ts_subtree_child_count(*entry.tree); i < n; i++) {
-      Subtree *child = &result.ptr->children[i];
-      Length child_size = ts_subtree_total_size(*child);
+    bool done = false;
+    for (uint32_t i = 0; i < child_count && !done; i++) {
+      Subtree child = entry.tree.ptr->children[i];
       child_left = child_right;
-      child_right = length_add(child_left, child_size);
-
-      // If this child ends before the edit, it is not affected.
-      if (child_right.bytes + ts_subtree_lookahead_bytes(*child) < edit.start.bytes) continue;
-
-      // If this child starts after the edit, then we're done processing children.
-      if (child_left.bytes > edit.old_end.bytes ||
-          (child_left.bytes == edit.old_end.bytes && child_size.bytes > 0 && i > 0)) break;
-
-      // Transform edit into the child's coordinate space.
-      Edit child_edit = {
-        .start = length_sub(edit.start, child_left),
-        .old_end = length_sub(edit.old_end, child_left),
-        .new_end = length_sub(edit.new_end, child_left),
-      };
-
-      // Clamp child_edit to the child's bounds.
-      if (edit.start.bytes < child_left.bytes) child_edit.start = length_zero();
-      if (edit.old_end.bytes < child_left.bytes) child_edit.old_end = length_zero();
-      if (edit.new_end.bytes < child_left.bytes) child_edit.new_end = length_zero();
-      if (edit.old_end.bytes > child_right.bytes) child_edit.old_end = child_size;
-
-      // Interpret all inserted text as applying to the *first* child that touches the edit.
-      // Subsequent children are only never have any text inserted into them; they are only
-      // shrunk to compensate for the edit.
-      if (child_right.bytes > edit.start.bytes ||
-          (child_right.bytes == edit.start.bytes && is_pure_insertion)) {
-        edit.new_end = edit.start;
+      child_right = length_add(child_left, ts_subtree_total_size(child));
+      if (!ts_subtree__child_touches_edit(
+        &edit, child_left, child_right, ts_subtree_lookahead_bytes(child), i, &done
+      )) continue;
+
+      array_push(&stack, ((StackEntry) {
+        .tree = child,
+        .edit = ts_subtree__child_edit(&edit, child_left, child_right),
+      }));
+    }
+  }
+
+  array_delete(&stack);
+  return result;
+}
+
+// Apply edits sorted by position in a single pass over the tree. Each node
+// receives the edits that reach it in the order that separate calls to
+// `ts_subtree_edit` would apply them, from the last edit to the first, so the
+// result is the same. The children of a node are only visited once all of
+// the node's edits are known. As the edits move backward, the children in
+// front of the ones already edited keep their positions, so the first child
+// that an edit can reach is found by bisection instead of a scan.
+Subtree ts_subtree_edit_batch(Subtree self, const TSInputEdit *edits, uint32_t count, SubtreePool *pool) {
+  typedef struct {
+    Subtree *tree;
+    uint32_t edit_index;
+    uint32_t edit_count;
+    uint32_t queue_end;
+  } StackEntry;
+
+  typedef struct {
+    uint32_t child_index;
+    Edit edit;
+  } ChildEdit;
+
+  typedef struct {
+    Length padding;
+    Length size;
+    Length end;
+    uint32_t edit_count;
+  } ChildState;
+
+  Array(Edit) queued_edits = array_new();
+  Array(StackEntry) stack = array_new();
+  Array(ChildEdit) child_edits = array_new();
+  Array(ChildState) children = array_new();
+
+  for (uint32_t i = count; i > 0; i--) {
+    const TSInputEdit *edit = &edits[i - 1];
+    array_push(&queued_edits, ((Edit) {
+      .start = {edit->start_byte, edit->start_point},
+      .old_end = {edit->old_end_byte, edit->old_end_point},
+      .new_end = {edit->new_end_byte, edit->new_end_point},
+    }));
+  }
+  array_push(&stack, ((StackEntry) {
+    .tree = &self, .edit_index = 0, .edit_count = count, .queue_end = count
+  }));
+
+  while (stack.size) {
+    // The edits queued after this entry's siblings belonged to entries that
+    // have been processed already.
+    StackEntry entry = array_pop(&stack);
+    queued_edits.size = entry.queue_end;
+    Subtree tree = *entry.tree;
+    Length size = ts_subtree_size(tree);
+    Length padding = ts_subtree_padding(tree);
+    uint32_t lookahead_bytes = ts_subtree_lookahead_bytes(tree);
+    uint32_t child_count = ts_subtree_child_count(tree);
+    bool changed = false;
+
+    // The end positions of the children before `unedited_count` are unchanged.
+    array_clear(&child_edits);
+    array_clear(&children);
+    uint32_t unedited_count = child_count;
+    uint32_t max_lookahead_bytes = 0;
+    Length end = length_zero();
+    for (uint32_t i = 0; i < child_count; i++) {
+      Subtree child = tree.ptr->children[i];
+      Length child_padding = ts_subtree_padding(child), child_size = ts_subtree_size(child);
+      end = length_add(end, length_add(child_padding, child_size));
+      array_push(&children, ((ChildState) {child_padding, child_size, end, 0}));
+      if (ts_subtree_lookahead_bytes(child) > max_lookahead_bytes) {
+        max_lookahead_bytes = ts_subtree_lookahead_bytes(child);
       }
+    }
 
-      // Children that occur before the edit are not reshaped by the edit.
-      else {
-        child_edit.old_end = child_edit.start;
-        child_edit.new_end = child_edit.start;
+    for (uint32_t j = 0; j < entry.edit_count; j++) {
+      Edit edit = queued_edits.contents[entry.edit_index + j];
+      if (!ts_subtree__edit_lengths(edit, lookahead_bytes, &padding, &size)) continue;
+      changed = true;
+
+      // Skip the children that end too far before the edit for their
+      // lookahead to reach it.
+      uint32_t low = 0, high = unedited_count;
+      while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (children.contents[mid].end.bytes + max_lookahead_bytes < edit.start.bytes) {
+          low = mid + 1;
+        } else {
+          high = mid;
+        }
       }
 
-      // Queue processing of this child's subtree.
+      // The children already carry the edits before this one.
+      Length child_left, child_right = low > 0 ? children.contents[low - 1].end : length_zero();
+      bool done = false;
+      for (uint32_t i = low; i < child_count && !done; i++) {
+        ChildState *child = &children.contents[i];
+        uint32_t child_lookahead_bytes = ts_subtree_lookahead_bytes(tree.ptr->children[i]);
+        child_left = child_right;
+        child_right = length_add(child_left, length_add(child->padding, child->size));
+        if (!ts_subtree__child_touches_edit(
+          &edit, child_left, child_right, child_lookahead_bytes, i, &done
+        )) continue;
+
+        Edit child_edit = ts_subtree__child_edit(&edit, child_left, child_right);
+        ts_subtree__edit_lengths(child_edit, child_lookahead_bytes, &child->padding, &child->size);
+        child->edit_count++;
+        if (i < unedited_count) unedited_count = i;
+        array_push(&child_edits, ((ChildEdit) {i, child_edit}));
+      }
+    }
+
+    if (!changed) continue;
+
+    MutableSubtree result = ts_subtree__resize(
+      pool, ts_subtree_make_mut(pool, tree), padding, size, lookahead_bytes
+    );
+    ts_subtree_set_has_changes(&result);
+    *entry.tree = ts_subtree_from_mut(result);
+    if (child_edits.size == 0) continue;
+
+    // Queue each child with its own edits, in the order they were made.
+    uint32_t edit_index = queued_edits.size;
+    array_grow_by(&queued_edits, child_edits.size);
+    for (uint32_t i = 0; i < child_count; i++) {
+      ChildState *child = &children.contents[i];
+      if (child->edit_count == 0) continue;
       array_push(&stack, ((StackEntry) {
-        .tree = child,
-        .edit = child_edit,
+        .tree = &result.ptr->children[i],
+        .edit_index = edit_index,
+        .edit_count = child->edit_count,
+        .queue_end = queued_edits.size,
       }));
+      child->edit_count = edit_index;
+      edit_index += stack.contents[stack.size - 1].edit_count;
+    }
+    for (uint32_t k = 0; k < child_edits.size; k++) {
+      ChildEdit *child_edit = &child_edits.contents[k];
+      queued_edits.contents[children.contents[child_edit->child_index].edit_count++] = child_edit->edit;
     }
   }
 
+  array_delete(&queued_edits);
   array_delete(&stack);
+  array_delete(&child_edits);
+  array_delete(&children);
+  return self;
+}
+
+// Widen the padding of a subtree, and of every node down to its first leaf,
+// as if the given whitespace had been lexed in front of it. Unlike an edit,
+// this leaves the nodes reusable.
+Subtree ts_subtree_grow_padding(Subtree self, Length padding, SubtreePool *pool) {
+  Subtree *tree = &self;
+  for (;;) {
+    Length new_padding = length_add(padding, ts_subtree_padding(*tree));
+    MutableSubtree result = ts_subtree__resize(
+      pool, ts_subtree_make_mut(pool, *tree),
+      new_padding, ts_subtree_size(*tree), ts_subtree_lookahead_bytes(*tree)
+    );
+    *tree = ts_subtree_from_mut(result);
+    if (ts_subtree_child_count(*tree) == 0) break;
+    tree = &result.ptr->children[0];
+  }
   return self;
 }
 
+// Copy a tree into a single slab, laying out each node followed by its child
+// array in depth-first order, so that walking the copy reads memory forward.
+// The copy shares no nodes with the original tree.
+Subtree ts_subtree_compact(Subtree self) {
+  if (self.data.is_inline) return self;
+
+  size_t size = 0;
+  uint32_t block_count = 0;
+  SubtreeArray stack = array_new();
+  array_push(&stack, self);
+  while (stack.size > 0) {
+    Subtree tree = array_pop(&stack);
+    size += sizeof(SubtreeSlabBlock) + ts_subtree_slab__align(sizeof(SubtreeHeapData));
+    block_count++;
+    if (tree.ptr->child_count > 0) {
+      size += sizeof(SubtreeSlabBlock) + ts_subtree_slab__align(tree.ptr->child_count * sizeof(Subtree));
+      block_count++;
+      for (uint32_t i = 0; i < tree.ptr->child_count; i++) {
+        Subtree child = tree.ptr->children[i];
+        if (!child.data.is_inline) array_push(&stack, child);
+      }
+    }
+  }
+  array_delete(&stack);
+
+  SubtreeSlab *slab = ts_subtree_slab_new(size, block_count);
+  uint32_t offset = 0;
+  Subtree result = self;
+  Array(Subtree *) slots = array_new();
+  array_push(&slots, &result);
+  while (slots.size > 0) {
+    Subtree *slot = array_pop(&slots);
+    if (slot->data.is_inline) continue;
+    const SubtreeHeapData *source = slot->ptr;
+    SubtreeHeapData *data = ts_subtree_slab__carve(slab, &offset, sizeof(SubtreeHeapData));
+    memcpy(data, source, sizeof(SubtreeHeapData));
+    data->ref_count = 1;
+    if (data->child_count > 0) {
+      data->children = ts_subtree_slab__carve(slab, &offset, data->child_count * sizeof(Subtree));
+      data->slab_children = true;
+      memcpy(data->children, source->children, data->child_count * sizeof(Subtree));
+      for (uint32_t i = data->child_count; i > 0; i--) {
+        array_push(&slots, &data->children[i - 1]);
+      }
+    } else if (data->has_external_tokens) {
+      data->external_scanner_state = ts_external_scanner_state_copy(&source->external_scanner_state);
+    }
+    *slot = (Subtree) {.ptr = data};
+  }
+  array_delete(&slots);
+  return result;
+}
+
 Subtree ts_subtree_last_external_token(Subtree tree) {
   if (!ts_subtree_has_external_tokens(tree)) return NULL_SUBTREE;
   while (tree.ptr->child_count > 0) {
@@ -902,7 +1297,7 @@ char *ts_subtree_string(
     language, include_all,
     0, false, ROOT_FIELD
   ) + 1;
-  char *result = malloc(size * sizeof(char));
+  char *result = ts_malloc(size * sizeof(char));
   ts_subtree__write_to_string(
     self, result, size,
     language, include_all,
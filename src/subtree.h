@@ -64,6 +64,9 @@ typedef struct {
   bool has_external_tokens : 1;
   bool is_missing : 1;
   bool is_keyword : 1;
+  bool slab_children : 1;
+  // Nothing in this subtree is left for ts_subtree_balance to compress
+  bool is_balanced : 1;
 
   union {
     // Non-terminal subtrees (`child_count > 0`)
@@ -79,6 +82,8 @@ typedef struct {
         TSSymbol symbol;
         TSStateId parse_state;
       } first_leaf;
+      // One bit per bucket of public symbols found anywhere below this node
+      uint32_t symbol_summary;
     };
 
     // External terminal subtrees (`child_count == 0 && has_external_tokens`)
@@ -102,9 +107,19 @@ union MutableSubtree {
 typedef Array(Subtree) SubtreeArray;
 typedef Array(MutableSubtree) MutableSubtreeArray;
 
+// A slab is a block of memory that subtrees are carved from. Every carved
+// block starts with a pointer to its slab, and the slab is freed once all of
+// its blocks are freed and no pool allocates from it any more.
+typedef struct {
+  volatile uint32_t ref_count;
+  uint32_t size;
+} SubtreeSlab;
+
 typedef struct {
   MutableSubtreeArray free_trees;
   MutableSubtreeArray tree_stack;
+  SubtreeSlab *slab;
+  uint32_t slab_offset;
 } SubtreePool;
 
 void ts_external_scanner_state_init(ExternalScannerState *, const char *, unsigned);
@@ -137,6 +152,10 @@ void ts_subtree_set_symbol(MutableSubtree *, TSSymbol, const TSLanguage *);
 void ts_subtree_set_children(MutableSubtree, Subtree *, uint32_t, const TSLanguage *);
 void ts_subtree_balance(Subtree, SubtreePool *, const TSLanguage *);
 Subtree ts_subtree_edit(Subtree, const TSInputEdit *edit, SubtreePool *);
+bool ts_subtree_edit_copies(Subtree, const TSInputEdit *edit);
+Subtree ts_subtree_edit_batch(Subtree, const TSInputEdit *, uint32_t, SubtreePool *);
+Subtree ts_subtree_grow_padding(Subtree, Length, SubtreePool *);
+Subtree ts_subtree_compact(Subtree);
 char *ts_subtree_string(Subtree, const TSLanguage *, bool include_all);
 void ts_subtree_print_dot_graph(Subtree, const TSLanguage *, FILE *);
 Subtree ts_subtree_last_external_token(Subtree);
@@ -206,6 +225,20 @@ static inline uint32_t ts_subtree_child_count(Subtree self) {
   return self.data.is_inline ? 0 : self.ptr->child_count;
 }
 
+static inline bool ts_subtree_is_balanced(Subtree self) {
+  return self.data.is_inline || self.ptr->child_count == 0 || self.ptr->is_balanced;
+}
+
+// Symbols share the summary bits by their value modulo 32, a clear bit means
+// none of them occur in the subtree.
+static inline uint32_t ts_symbol_summary_bit(TSSymbol symbol) {
+  return 1u << (symbol & 31);
+}
+
+static inline uint32_t ts_subtree_symbol_summary(Subtree self) {
+  return (self.data.is_inline || self.ptr->child_count == 0) ? 0 : self.ptr->symbol_summary;
+}
+
 static inline uint32_t ts_subtree_repeat_depth(Subtree self) {
   return self.data.is_inline ? 0 : self.ptr->repeat_depth;
 }
@@ -0,0 +1,167 @@
+#undef TS_ALLOCATION_SUBSYSTEM
+#define TS_ALLOCATION_SUBSYSTEM TSAllocationSubsystemOther
+
+#include <time.h>
+#include "./alloc.h"
+#include "./atomic.h"
+#include "./trace.h"
+
+#ifdef TREE_SITTER_TRACE
+
+#ifdef _MSC_VER
+#define TS_THREAD_LOCAL __declspec(thread)
+#else
+#define TS_THREAD_LOCAL __thread
+#endif
+
+// The number of spans kept per thread, a power of two.
+#define TS_TRACE_BUFFER_SIZE 16384
+
+typedef struct {
+  const char *category;
+  const char *name;
+  uint64_t start;
+  uint64_t end;
+} TraceSpan;
+
+// Each thread appends to its own ring, so recording never takes a lock. The
+// rings are pushed onto a global list once, when a thread records its first
+// span, and stay alive until the process exits.
+typedef struct TraceBuffer {
+  struct TraceBuffer *next;
+  uint32_t thread_index;
+  uint64_t count;
+  TraceSpan spans[TS_TRACE_BUFFER_SIZE];
+} TraceBuffer;
+
+static TraceBuffer *volatile ts_trace_buffers = NULL;
+static volatile uint32_t ts_trace_thread_count = 0;
+static TS_THREAD_LOCAL TraceBuffer *ts_trace_buffer = NULL;
+
+static TraceBuffer *ts_trace__buffer(void) {
+  if (!ts_trace_buffer) {
+    TraceBuffer *buffer = ts_calloc(1, sizeof(TraceBuffer));
+    buffer->thread_index = atomic_inc(&ts_trace_thread_count);
+    do {
+      buffer->next = ts_trace_buffers;
+    } while (!atomic_compare_exchange_ptr(
+      (void *volatile *)&ts_trace_buffers, buffer->next, buffer
+    ));
+    ts_trace_buffer = buffer;
+  }
+  return ts_trace_buffer;
+}
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+uint64_t ts_trace_now(void) {
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  uint64_t ticks = (uint64_t)counter.QuadPart, rate = (uint64_t)frequency.QuadPart;
+  return ticks / rate * 1000000000 + ticks % rate * 1000000000 / rate;
+}
+
+#elif defined(CLOCK_MONOTONIC)
+
+uint64_t ts_trace_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+#else
+
+uint64_t ts_trace_now(void) {
+  return (uint64_t)clock() * 1000000000 / (uint64_t)CLOCKS_PER_SEC;
+}
+
+#endif
+
+void ts_trace_record(const char *category, const char *name, uint64_t start, uint64_t end) {
+  TraceBuffer *buffer = ts_trace__buffer();
+  TraceSpan *span = &buffer->spans[buffer->count & (TS_TRACE_BUFFER_SIZE - 1)];
+  span->category = category;
+  span->name = name;
+  span->start = start;
+  span->end = end;
+  buffer->count++;
+}
+
+void ts_trace_clear(void) {
+  for (TraceBuffer *buffer = ts_trace_buffers; buffer; buffer = buffer->next) {
+    buffer->count = 0;
+  }
+}
+
+static void ts_trace__write_string(FILE *file, const char *string) {
+  fputc('"', file);
+  for (const char *c = string ? string : ""; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', file);
+      fputc(*c, file);
+    } else if ((unsigned char)*c < 0x20) {
+      fprintf(file, "\\u%04x", (unsigned char)*c);
+    } else {
+      fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+void ts_trace_write_chrome_json(FILE *file) {
+  // Timestamps are written relative to the earliest span, in microseconds.
+  uint64_t epoch = UINT64_MAX;
+  for (TraceBuffer *buffer = ts_trace_buffers; buffer; buffer = buffer->next) {
+    uint64_t begin = buffer->count > TS_TRACE_BUFFER_SIZE ? buffer->count - TS_TRACE_BUFFER_SIZE : 0;
+    for (uint64_t i = begin; i < buffer->count; i++) {
+      TraceSpan *span = &buffer->spans[i & (TS_TRACE_BUFFER_SIZE - 1)];
+      if (span->start < epoch) epoch = span->start;
+    }
+  }
+
+  bool is_first = true;
+  fputs("{\"traceEvents\":[", file);
+  for (TraceBuffer *buffer = ts_trace_buffers; buffer; buffer = buffer->next) {
+    uint64_t begin = buffer->count > TS_TRACE_BUFFER_SIZE ? buffer->count - TS_TRACE_BUFFER_SIZE : 0;
+    for (uint64_t i = begin; i < buffer->count; i++) {
+      TraceSpan *span = &buffer->spans[i & (TS_TRACE_BUFFER_SIZE - 1)];
+      fputs(is_first ? "\n{\"cat\":" : ",\n{\"cat\":", file);
+      ts_trace__write_string(file, span->category);
+      fputs(",\"name\":", file);
+      ts_trace__write_string(file, span->name);
+      fprintf(
+        file,
+        ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+        buffer->thread_index,
+        (span->start - epoch) / 1000.0,
+        (span->end > span->start ? span->end - span->start : 0) / 1000.0
+      );
+      is_first = false;
+    }
+  }
+  fputs("\n]}\n", file);
+}
+
+#else
+
+uint64_t ts_trace_now(void) {
+  return 0;
+}
+
+void ts_trace_record(const char *category, const char *name, uint64_t start, uint64_t end) {
+  (void)category;
+  (void)name;
+  (void)start;
+  (void)end;
+}
+
+void ts_trace_clear(void) {}
+
+void ts_trace_write_chrome_json(FILE *file) {
+  fputs("{\"traceEvents\":[]}\n", file);
+}
+
+#endif
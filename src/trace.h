@@ -0,0 +1,30 @@
+#ifndef TREE_SITTER_TRACE_H_
+#define TREE_SITTER_TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "tree_sitter/api.h"
+
+// Spans around the runtime's own phases. Without TREE_SITTER_TRACE these
+// expand to nothing, so an untraced build does not even read the clock.
+#ifdef TREE_SITTER_TRACE
+
+#define TS_TRACE_BEGIN(span) uint64_t span##_trace_start = ts_trace_now()
+
+#define TS_TRACE_END(span, name) \
+  ts_trace_record("tree-sitter", name, span##_trace_start, ts_trace_now())
+
+#else
+
+#define TS_TRACE_BEGIN(span)
+#define TS_TRACE_END(span, name)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TREE_SITTER_TRACE_H_
@@ -1,3 +1,6 @@
+#undef TS_ALLOCATION_SUBSYSTEM
+#define TS_ALLOCATION_SUBSYSTEM TSAllocationSubsystemTree
+
 #include "tree_sitter/api.h"
 #include "./array.h"
 #include "./get_changed_ranges.h"
@@ -7,6 +10,10 @@
 
 static const unsigned PARENT_CACHE_CAPACITY = 32;
 
+// Beyond this many edits, the parser's token cache is dropped rather than
+// replaying every edit on it.
+static const unsigned MAX_RECORDED_EDIT_COUNT = 64;
+
 TSTree *ts_tree_new(
   Subtree root, const TSLanguage *language,
   const TSRange *included_ranges, unsigned included_range_count
@@ -17,15 +24,31 @@ TSTree *ts_tree_new(
   result->parent_cache = NULL;
   result->parent_cache_start = 0;
   result->parent_cache_size = 0;
+  result->parent_index = NULL;
+  result->parent_index_capacity = 0;
+  array_init(&result->parent_index_nodes);
+  array_init(&result->parent_index_edits);
+  result->parent_index_enabled = false;
   result->included_ranges = ts_calloc(included_range_count, sizeof(TSRange));
   memcpy(result->included_ranges, included_ranges, included_range_count * sizeof(TSRange));
   result->included_range_count = included_range_count;
+  result->token_cache_id = 0;
+  result->edits = NULL;
+  result->edit_count = 0;
   return result;
 }
 
 TSTree *ts_tree_copy(const TSTree *self) {
   ts_subtree_retain(self->root);
-  return ts_tree_new(self->root, self->language, self->included_ranges, self->included_range_count);
+  TSTree *result = ts_tree_new(self->root, self->language, self->included_ranges, self->included_range_count);
+  result->token_cache_id = self->token_cache_id;
+  result->parent_index_enabled = self->parent_index_enabled;
+  if (self->token_cache_id && self->edit_count) {
+    result->edits = ts_calloc(self->edit_count, sizeof(TSInputEdit));
+    memcpy(result->edits, self->edits, self->edit_count * sizeof(TSInputEdit));
+    result->edit_count = self->edit_count;
+  }
+  return result;
 }
 
 void ts_tree_delete(TSTree *self) {
@@ -36,6 +59,10 @@ void ts_tree_delete(TSTree *self) {
   ts_subtree_pool_delete(&pool);
   ts_free(self->included_ranges);
   if (self->parent_cache) ts_free(self->parent_cache);
+  if (self->parent_index) ts_free(self->parent_index);
+  array_delete(&self->parent_index_nodes);
+  array_delete(&self->parent_index_edits);
+  if (self->edits) ts_free(self->edits);
   ts_free(self);
 }
 
@@ -47,7 +74,57 @@ const TSLanguage *ts_tree_language(const TSTree *self) {
   return self->language;
 }
 
-void ts_tree_edit(TSTree *self, const TSInputEdit *edit) {
+// The cached parents point at stale positions once the tree changes.
+static void ts_tree__clear_parents(TSTree *self) {
+  self->parent_cache_start = 0;
+  self->parent_cache_size = 0;
+  if (self->parent_index) {
+    ts_free(self->parent_index);
+    self->parent_index = NULL;
+    self->parent_index_capacity = 0;
+    array_delete(&self->parent_index_nodes);
+    array_delete(&self->parent_index_edits);
+  }
+}
+
+// The index is keyed by the addresses of the nodes in their parents' child
+// arrays. An edit resizes the nodes it reaches in place, so the keys stay
+// valid, and every node moves as `ts_node_edit` would move it. The edits are
+// recorded, and replayed on a parent's position when it's looked up. But an
+// edit copies the nodes it reaches that are shared with another tree, child
+// arrays and all, and then the index is dropped.
+static void ts_tree__edit_parents(TSTree *self, const TSInputEdit *edits, uint32_t count) {
+  self->parent_cache_start = 0;
+  self->parent_cache_size = 0;
+  if (!self->parent_index) return;
+  bool keep = self->parent_index_edits.size + count <= MAX_RECORDED_EDIT_COUNT;
+  for (uint32_t i = 0; i < count && keep; i++) {
+    keep = !ts_subtree_edit_copies(self->root, &edits[i]);
+  }
+  if (!keep) {
+    ts_tree__clear_parents(self);
+    return;
+  }
+
+  // Batched edits are applied from the last one to the first
+  for (uint32_t i = count; i > 0; i--) {
+    array_push(&self->parent_index_edits, edits[i - 1]);
+  }
+}
+
+// Record the edit for the parser's token cache.
+static void ts_tree__record_edit(TSTree *self, const TSInputEdit *edit) {
+  if (self->token_cache_id) {
+    if (self->edit_count < MAX_RECORDED_EDIT_COUNT) {
+      self->edits = ts_realloc(self->edits, (self->edit_count + 1) * sizeof(TSInputEdit));
+      self->edits[self->edit_count++] = *edit;
+    } else {
+      self->token_cache_id = 0;
+    }
+  }
+}
+
+static void ts_tree__edit_included_ranges(TSTree *self, const TSInputEdit *edit) {
   for (unsigned i = 0; i < self->included_range_count; i++) {
     TSRange *range = &self->included_ranges[i];
     if (range->end_byte >= edit->old_end_byte) {
@@ -75,14 +152,86 @@ void ts_tree_edit(TSTree *self, const TSInputEdit *edit) {
       }
     }
   }
+}
+
+void ts_tree_edit(TSTree *self, const TSInputEdit *edit) {
+  ts_tree__record_edit(self, edit);
+  ts_tree__edit_included_ranges(self, edit);
+
+  ts_tree__edit_parents(self, edit, 1);
 
   SubtreePool pool = ts_subtree_pool_new(0);
   self->root = ts_subtree_edit(self->root, edit, &pool);
-  self->parent_cache_start = 0;
-  self->parent_cache_size = 0;
   ts_subtree_pool_delete(&pool);
 }
 
+void ts_tree_edit_batch(TSTree *self, const TSInputEdit *edits, uint32_t count) {
+  for (uint32_t i = count; i > 0; i--) {
+    assert(i == count || edits[i - 1].old_end_byte <= edits[i].start_byte);
+    ts_tree__record_edit(self, &edits[i - 1]);
+    ts_tree__edit_included_ranges(self, &edits[i - 1]);
+  }
+
+  ts_tree__edit_parents(self, edits, count);
+
+  SubtreePool pool = ts_subtree_pool_new(0);
+  self->root = ts_subtree_edit_batch(self->root, edits, count, &pool);
+  ts_subtree_pool_delete(&pool);
+}
+
+void ts_tree_compact(TSTree *self) {
+  Subtree root = ts_subtree_compact(self->root);
+  SubtreePool pool = ts_subtree_pool_new(0);
+  ts_subtree_release(&pool, self->root);
+  ts_subtree_pool_delete(&pool);
+  self->root = root;
+  ts_tree__clear_parents(self);
+}
+
+TSTree *ts_tree_join(const TSTree *const *trees, uint32_t count) {
+  if (count == 0) return NULL;
+  if (count == 1) return ts_tree_copy(trees[0]);
+
+  const TSTree *first = trees[0];
+  SubtreePool pool = ts_subtree_pool_new(0);
+  SubtreeArray children = array_new();
+  Length carried_padding = length_zero();
+  for (uint32_t i = 0; i < count; i++) {
+    Subtree root = trees[i]->root;
+    uint32_t child_count = ts_subtree_child_count(root);
+    const Subtree *root_children = child_count ? root.ptr->children : &trees[i]->root;
+    if (!child_count) child_count = 1;
+
+    for (uint32_t j = 0; j < child_count; j++) {
+      Subtree child = root_children[j];
+
+      // Only the last tree ends the document, the whitespace before the end of
+      // the other trees moves in front of the next tree's first node.
+      if (i + 1 < count && j + 1 == child_count && ts_subtree_is_eof(child)) {
+        carried_padding = length_add(carried_padding, ts_subtree_total_size(child));
+        continue;
+      }
+
+      ts_subtree_retain(child);
+      if (carried_padding.bytes > 0) {
+        child = ts_subtree_grow_padding(child, carried_padding, &pool);
+        carried_padding = length_zero();
+      }
+      array_push(&children, child);
+    }
+  }
+
+  Subtree root = ts_subtree_from_mut(ts_subtree_new_node(
+    &pool,
+    ts_subtree_symbol(first->root),
+    &children,
+    ts_subtree_production_id(first->root),
+    first->language
+  ));
+  ts_subtree_pool_delete(&pool);
+  return ts_tree_new(root, first->language, first->included_ranges, first->included_range_count);
+}
+
 TSRange *ts_tree_get_changed_ranges(const TSTree *self, const TSTree *other, uint32_t *count) {
   TreeCursor cursor1 = {NULL, array_new()};
   TreeCursor cursor2 = {NULL, array_new()};
@@ -112,7 +261,91 @@ void ts_tree_print_dot_graph(const TSTree *self, FILE *file) {
   ts_subtree_print_dot_graph(self->root, self->language, file);
 }
 
-TSNode ts_tree_get_cached_parent(const TSTree *self, const TSNode *node) {
+void ts_tree_set_parent_index_enabled(TSTree *self, bool enabled) {
+  self->parent_index_enabled = enabled;
+  if (!enabled) ts_tree__clear_parents(self);
+}
+
+// The index maps every visible node to one of the visible nodes with children,
+// the table is sized from the node count and has no power of two capacity.
+static inline uint32_t ts_tree__parent_index_slot(const TSTree *self, const void *child) {
+  uint32_t hash = (uint32_t)(((uint64_t)(uintptr_t)child * 0x9E3779B97F4A7C15ull) >> 32);
+  return (uint32_t)(((uint64_t)hash * self->parent_index_capacity) >> 32);
+}
+
+static void ts_tree__index_parent(TSTree *self, const TSNode *node, uint32_t parent) {
+  uint32_t index = ts_tree__parent_index_slot(self, node->id);
+  while (self->parent_index[index].child) {
+    if (++index == self->parent_index_capacity) index = 0;
+  }
+  self->parent_index[index] = (ParentIndexEntry) {(const Subtree *)node->id, parent};
+}
+
+// Walk the visible nodes once, with a stack of their visible ancestors.
+static void ts_tree__build_parent_index(TSTree *self) {
+  uint32_t node_count = ts_subtree_node_count(self->root);
+  self->parent_index_capacity = node_count + node_count / 4 + 1;
+  self->parent_index = ts_calloc(self->parent_index_capacity, sizeof(ParentIndexEntry));
+
+  TSNode node = ts_tree_root_node(self);
+  TSTreeCursor cursor = ts_tree_cursor_new(node);
+  Array(uint32_t) parents = array_new();
+  for (;;) {
+    if (ts_tree_cursor_goto_first_child(&cursor)) {
+      array_push(&parents, self->parent_index_nodes.size);
+      array_push(&self->parent_index_nodes, ((ParentIndexNode) {
+        .node = (const Subtree *)node.id,
+        .position = {node.context[0], {node.context[1], node.context[2]}},
+        .alias_symbol = node.context[3],
+        .edit_count = 0,
+      }));
+    } else {
+      while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+        if (!ts_tree_cursor_goto_parent(&cursor)) goto done;
+        parents.size--;
+      }
+    }
+    node = ts_tree_cursor_current_node(&cursor);
+    ts_tree__index_parent(self, &node, *array_back(&parents));
+  }
+
+done:
+  array_delete(&parents);
+  ts_tree_cursor_delete(&cursor);
+}
+
+// Move a position the way `ts_node_edit` moves a node's start.
+static Length ts_tree__edit_position(Length position, const TSInputEdit *edit) {
+  if (position.bytes >= edit->old_end_byte) {
+    position.bytes = edit->new_end_byte + (position.bytes - edit->old_end_byte);
+    position.extent = point_add(edit->new_end_point, point_sub(position.extent, edit->old_end_point));
+  } else if (position.bytes > edit->start_byte) {
+    position.bytes = edit->new_end_byte;
+    position.extent = edit->new_end_point;
+  }
+  return position;
+}
+
+TSNode ts_tree_get_cached_parent(const TSTree *_self, const TSNode *node) {
+  TSTree *self = (TSTree *)_self;
+  if (self->parent_index_enabled) {
+    if (!self->parent_index) ts_tree__build_parent_index(self);
+    uint32_t index = ts_tree__parent_index_slot(self, node->id);
+    for (;;) {
+      ParentIndexEntry *entry = &self->parent_index[index];
+      if (entry->child == node->id) {
+        ParentIndexNode *parent = &self->parent_index_nodes.contents[entry->parent];
+        Length position = parent->position;
+        for (uint32_t i = parent->edit_count; i < self->parent_index_edits.size; i++) {
+          position = ts_tree__edit_position(position, &self->parent_index_edits.contents[i]);
+        }
+        return ts_node_new(self, parent->node, position, parent->alias_symbol);
+      }
+      if (!entry->child) break;
+      if (++index == self->parent_index_capacity) index = 0;
+    }
+  }
+
   for (uint32_t i = 0; i < self->parent_cache_size; i++) {
     uint32_t index = (self->parent_cache_start + i) % PARENT_CACHE_CAPACITY;
     ParentCacheEntry *entry = &self->parent_cache[index];
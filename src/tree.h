@@ -12,14 +12,35 @@ typedef struct {
   TSSymbol alias_symbol;
 } ParentCacheEntry;
 
+typedef struct {
+  const Subtree *child;
+  uint32_t parent;
+} ParentIndexEntry;
+
+typedef struct {
+  const Subtree *node;
+  Length position;
+  TSSymbol alias_symbol;
+  // The recorded edits from this one on were made after `position` was taken
+  uint32_t edit_count;
+} ParentIndexNode;
+
 struct TSTree {
   Subtree root;
   const TSLanguage *language;
   ParentCacheEntry *parent_cache;
   uint32_t parent_cache_start;
   uint32_t parent_cache_size;
+  ParentIndexEntry *parent_index;
+  uint32_t parent_index_capacity;
+  Array(ParentIndexNode) parent_index_nodes;
+  Array(TSInputEdit) parent_index_edits;
+  bool parent_index_enabled;
   TSRange *included_ranges;
   unsigned included_range_count;
+  uint64_t token_cache_id;
+  TSInputEdit *edits;
+  uint32_t edit_count;
 };
 
 TSTree *ts_tree_new(Subtree root, const TSLanguage *language, const TSRange *, unsigned);
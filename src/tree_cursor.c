@@ -1,3 +1,6 @@
+#undef TS_ALLOCATION_SUBSYSTEM
+#define TS_ALLOCATION_SUBSYSTEM TSAllocationSubsystemTree
+
 #include "tree_sitter/api.h"
 #include "./alloc.h"
 #include "./tree_cursor.h"
@@ -201,6 +204,88 @@ bool ts_tree_cursor_goto_next_sibling(TSTreeCursor *_self) {
   return false;
 }
 
+// A hidden subtree is entered only if its symbol summary shares a bit with
+// `summary_mask` and it ends after `start_byte`, the nodes inside it are
+// skipped otherwise.
+static inline bool ts_tree_cursor__can_enter(
+  const TreeCursorEntry *entry,
+  uint32_t summary_mask,
+  uint32_t start_byte
+) {
+  return
+    ts_subtree_visible_child_count(*entry->subtree) > 0 &&
+    (ts_subtree_symbol_summary(*entry->subtree) & summary_mask) &&
+    entry->position.bytes + ts_subtree_size(*entry->subtree).bytes > start_byte;
+}
+
+static bool ts_tree_cursor__descend_in_summary(
+  TreeCursor *self,
+  uint32_t summary_mask,
+  uint32_t start_byte
+) {
+  bool visible;
+  TreeCursorEntry entry;
+  CursorChildIterator iterator = ts_tree_cursor_iterate_children(self);
+  while (ts_tree_cursor_child_iterator_next(&iterator, &entry, &visible)) {
+    if (visible) {
+      array_push(&self->stack, entry);
+      return true;
+    }
+
+    if (ts_tree_cursor__can_enter(&entry, summary_mask, start_byte)) {
+      array_push(&self->stack, entry);
+      if (ts_tree_cursor__descend_in_summary(self, summary_mask, start_byte)) return true;
+      self->stack.size--;
+    }
+  }
+  return false;
+}
+
+bool ts_tree_cursor_goto_first_child_in_summary(
+  TSTreeCursor *_self,
+  uint32_t summary_mask,
+  uint32_t start_byte
+) {
+  return ts_tree_cursor__descend_in_summary((TreeCursor *)_self, summary_mask, start_byte);
+}
+
+bool ts_tree_cursor_goto_next_sibling_in_summary(
+  TSTreeCursor *_self,
+  uint32_t summary_mask,
+  uint32_t start_byte
+) {
+  TreeCursor *self = (TreeCursor *)_self;
+  uint32_t initial_size = self->stack.size;
+
+  while (self->stack.size > 1) {
+    TreeCursorEntry entry = array_pop(&self->stack);
+    CursorChildIterator iterator = ts_tree_cursor_iterate_children(self);
+    iterator.child_index = entry.child_index;
+    iterator.structural_child_index = entry.structural_child_index;
+    iterator.position = entry.position;
+
+    bool visible = false;
+    ts_tree_cursor_child_iterator_next(&iterator, &entry, &visible);
+    if (visible && self->stack.size + 1 < initial_size) break;
+
+    while (ts_tree_cursor_child_iterator_next(&iterator, &entry, &visible)) {
+      if (visible) {
+        array_push(&self->stack, entry);
+        return true;
+      }
+
+      if (ts_tree_cursor__can_enter(&entry, summary_mask, start_byte)) {
+        array_push(&self->stack, entry);
+        if (ts_tree_cursor__descend_in_summary(self, summary_mask, start_byte)) return true;
+        self->stack.size--;
+      }
+    }
+  }
+
+  self->stack.size = initial_size;
+  return false;
+}
+
 bool ts_tree_cursor_goto_parent(TSTreeCursor *_self) {
   TreeCursor *self = (TreeCursor *)_self;
   for (unsigned i = self->stack.size - 2; i + 1 > 0; i--) {
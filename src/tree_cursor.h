@@ -17,5 +17,7 @@ typedef struct {
 
 void ts_tree_cursor_init(TreeCursor *, TSNode);
 TSFieldId ts_tree_cursor_current_status(const TSTreeCursor *, bool *, bool *);
+bool ts_tree_cursor_goto_first_child_in_summary(TSTreeCursor *, uint32_t, uint32_t);
+bool ts_tree_cursor_goto_next_sibling_in_summary(TSTreeCursor *, uint32_t, uint32_t);
 
 #endif  // TREE_SITTER_TREE_CURSOR_H_
@@ -43,6 +43,20 @@ static inline uint32_t ts_decode_utf16(
   return i * 2;
 }
 
+static inline uint32_t ts_decode_utf32(
+  const uint8_t *string,
+  uint32_t length,
+  int32_t *code_point
+) {
+  if (length < 4) {
+    *code_point = TS_DECODE_ERROR;
+    return length;
+  }
+  uint32_t c = *(const uint32_t *)string;
+  *code_point = c <= 0x10FFFF ? (int32_t)c : TS_DECODE_ERROR;
+  return 4;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,6 +3,43 @@
 //
 #include <ast_buffer.h>
 #include <origin.h>
+#include <algorithm>
+// Save a table built on an origin file, journal more edits and restore it
+bool session_round_trip() {
+    const char *path = "session_origin.txt";
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    for (int i = 0; i < 100; ++i) {
+        fprintf(file, "origin line %d\n", i);
+    }
+    fclose(file);
+    std::string expected;
+    {
+        Origin origin(path);
+        PieceTable<char> table;
+        table.append_origin((const char *) origin.ptr(), origin.size());
+        table.insert(20, "inserted\ntext\n");
+        table.erase(100, 130);
+        Session<char> session("session_test.bin");
+        if (!session.save(table, {path})) {
+            return false;
+        }
+        table.insert(5, "journal\n");
+        session.record_insert(5, "journal\n");
+        table.erase(300, 320);
+        session.record_erase(300, 320);
+        expected = table.range_string(0, table.size());
+    }
+    PieceTable<char> table;
+    Session<char> session("session_test.bin");
+    if (!session.restore(table)) {
+        return false;
+    }
+    return table.range_string(0, table.size()) == expected &&
+           table.lines() == (size_t) std::count(expected.begin(), expected.end(), '\n');
+}
 int main() {
     ASTBuffer<char> ast(ts::Language::cpp());
     ast.parser().set_timeout(500);
@@ -28,13 +65,17 @@ int main() {
             "((string_literal) @string-inject (inject @string-inject \"shift\"))");
     auto cursor = query.exec(ast.tree().root());
     uint32_t index;
-    while (cursor.next_capture(index)) {
+    while (cursor.next_capture(index, ast)) {
         auto node = cursor.capture_node(index);
         auto name = cursor.capture_name(index);
         std::cout << "capture:" << node.string()
                   << " " << name
                   << " -> " ;
         std::cout << ast.node_string(node) << "  ";
+        auto &injection = query.injection(cursor.pattern_index());
+        if (!injection.empty()) {
+            std::cout << "inject:" << injection.language << " ";
+        }
         for (auto &step : query.pattern_predicates(cursor.pattern_index())) {
             if (step.type == TSQueryPredicateStepTypeCapture) {
                 std::cout << "@" << query.capture_name(step.value_id) << " ";
@@ -48,5 +89,13 @@ int main() {
         }
         std::cout << std::endl;
     }
+    auto functions = ts::Language::cpp().query("(function_declarator declarator: (identifier) @name)");
+    LiveQuery<char> live(ast, functions, [&](const LiveQuery<char>::Match &match, bool added) {
+        auto &name = match.captures[0];
+        std::cout << (added ? "+ " : "- ")
+                  << ast.buffer().range_string(name.start_byte, name.end_byte) << std::endl;
+    });
+    ast.insert(ast.buffer().size(), "int sub(int x, int y) {return x - y;}\n");
+    std::cout << "session round trip: " << (session_round_trip() ? "ok" : "failed") << std::endl;
     return 0;
 }